@@ -0,0 +1,218 @@
+/*
+ * dcache-lookup: measure how path lookup scales with the number of cpus
+ *
+ * Builds a directory tree, then has 1, 2, 4, ... threads stat() names in
+ * it as fast as they can, and reports the lookups per second for each
+ * thread count and how that compares to linear scaling from one thread.
+ * All names are in the dcache after the first pass, so this measures the
+ * cost of cached lookups and of the dentry references they take and drop,
+ * which is where contention on shared dcache locks shows up.
+ *
+ *   dcache-lookup [-n threads] [-d depth] [-f files] [-t secs] [-s] [-m] dir
+ *
+ *   -n threads	largest number of threads to run (default: online cpus)
+ *   -d depth	directories above each file (default 4)
+ *   -f files	files per leaf directory (default 64)
+ *   -t secs	seconds to run each thread count (default 2)
+ *   -s		all threads look up the same names, rather than each its
+ *		own subtree (unrelated paths, the case that should scale)
+ *   -m		look up names that do not exist (negative dentries)
+ *
+ * The tree is made under dir, which must exist, and removed at the end.
+ *
+ * Released under the General Public License (GPL).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct worker {
+	pthread_t thread;
+	int tree;
+	unsigned long lookups;
+	char pad[64];
+};
+
+static const char *base;
+static int depth = 4, files = 64, shared, misses;
+static volatile int stop;
+
+static void fatal(const char *x)
+{
+	perror(x);
+	exit(1);
+}
+
+/* Path of the leaf directory of tree @tree, depth components below base */
+static void leaf_dir(char *buf, size_t len, int tree)
+{
+	int n, i;
+
+	n = snprintf(buf, len, "%s/t%d", base, tree);
+	for (i = 0; i < depth; i++)
+		n += snprintf(buf + n, len - n, "/d%d", i);
+}
+
+static void make_tree(int tree)
+{
+	char path[4096];
+	int n, i;
+
+	n = snprintf(path, sizeof(path), "%s/t%d", base, tree);
+	if (mkdir(path, 0755))
+		fatal(path);
+	for (i = 0; i < depth; i++) {
+		n += snprintf(path + n, sizeof(path) - n, "/d%d", i);
+		if (mkdir(path, 0755))
+			fatal(path);
+	}
+	for (i = 0; i < files; i++) {
+		FILE *f;
+
+		snprintf(path + n, sizeof(path) - n, "/f%d", i);
+		f = fopen(path, "w");
+		if (!f)
+			fatal(path);
+		fclose(f);
+	}
+}
+
+static void remove_tree(int tree)
+{
+	char path[4096];
+	int n, i;
+
+	leaf_dir(path, sizeof(path), tree);
+	n = strlen(path);
+	for (i = 0; i < files; i++) {
+		snprintf(path + n, sizeof(path) - n, "/f%d", i);
+		unlink(path);
+	}
+	for (i = depth; i >= 0; i--) {
+		path[n] = '\0';
+		rmdir(path);
+		while (n > 0 && path[--n] != '/')
+			;
+	}
+}
+
+static void *run_lookups(void *arg)
+{
+	struct worker *w = arg;
+	char dir[2048], path[4096];
+	struct stat st;
+	int i = 0;
+
+	leaf_dir(dir, sizeof(dir), w->tree);
+	while (!stop) {
+		snprintf(path, sizeof(path), "%s/%c%d", dir,
+			 misses ? 'x' : 'f', i);
+		if (stat(path, &st) && !misses)
+			fatal(path);
+		w->lookups++;
+		if (++i == files)
+			i = 0;
+	}
+	return NULL;
+}
+
+static double run(int nr, int secs)
+{
+	struct worker *workers;
+	unsigned long lookups = 0;
+	int i;
+
+	workers = calloc(nr, sizeof(*workers));
+	if (!workers)
+		fatal("calloc");
+
+	stop = 0;
+	for (i = 0; i < nr; i++) {
+		workers[i].tree = shared ? 0 : i;
+		if (pthread_create(&workers[i].thread, NULL, run_lookups,
+				   &workers[i]))
+			fatal("pthread_create");
+	}
+	sleep(secs);
+	stop = 1;
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		lookups += workers[i].lookups;
+	}
+
+	free(workers);
+	return (double)lookups / secs;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n threads] [-d depth] [-f files] "
+		"[-t secs] [-s] [-m] dir\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, max = sysconf(_SC_NPROCESSORS_ONLN), secs = 2, nr, i;
+	double rate, single = 0;
+
+	while ((opt = getopt(argc, argv, "n:d:f:t:sm")) != -1) {
+		switch (opt) {
+		case 'n':
+			max = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'f':
+			files = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 's':
+			shared = 1;
+			break;
+		case 'm':
+			misses = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || max < 1 || depth < 0 || depth > 64 ||
+	    files < 1 || secs < 1)
+		usage(argv[0]);
+	base = argv[optind];
+
+	for (i = 0; i < (shared ? 1 : max); i++)
+		make_tree(i);
+
+	printf("%s names, %s paths, depth %d\n",
+	       misses ? "missing" : "cached", shared ? "shared" : "unrelated",
+	       depth + 2);
+	printf("threads   lookups/s   per thread   scaling\n");
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max)
+			nr = max;
+		rate = run(nr, secs);
+		if (nr == 1)
+			single = rate;
+		printf("%7d %11.0f %12.0f %8.2fx\n", nr, rate, rate / nr,
+		       single ? rate / single : 0.0);
+		if (nr == max)
+			break;
+	}
+
+	for (i = 0; i < (shared ? 1 : max); i++)
+		remove_tree(i);
+	return 0;
+}
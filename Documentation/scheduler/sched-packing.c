@@ -0,0 +1,253 @@
+/*
+ * sched-packing: measure small task packing with periodic tasks
+ *
+ * Runs a number of light periodic processes, the way pollers, audio or
+ * sensor threads and status daemons behave, each doing a fixed amount of
+ * work every period, and reports on which cpus their wakeups ran, how
+ * often every cpu left its idle states meanwhile, and the throughput
+ * and timeliness of the work: jobs done per second, jobs not finished
+ * before their next period and the average wakeup latency.
+ *
+ *   sched-packing [-n tasks] [-p period_ms] [-b busy_us] [-t secs]
+ *
+ *   -n tasks	number of periodic tasks (default 4)
+ *   -p period	period of each task in milliseconds (default 10)
+ *   -b busy	work done each period, in microseconds of cpu time at the
+ *		frequency the benchmark calibrates at (default 1000)
+ *   -t secs	seconds to run (default 10)
+ *
+ * Comparing runs with /proc/sys/kernel/sched_packing_threshold at 0 and
+ * at e.g. 80 shows what packing does to the idle exits of every cpu and
+ * what it costs in throughput and latency. The idle exits come from
+ * cpuidle, see Documentation/cpuidle/sysfs.txt, and are not shown on
+ * kernels without it.
+ *
+ * Released under the General Public License (GPL).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_CPUS	64
+#define MAX_STATES	16
+
+struct stats {
+	unsigned long wakeups[MAX_CPUS];
+	unsigned long jobs;
+	unsigned long missed;
+	unsigned long long latency_ns;
+};
+
+static unsigned long loops_per_busy;
+
+static void fatal(const char *x)
+{
+	perror(x);
+	exit(1);
+}
+
+static unsigned long long ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_ns(&ts);
+}
+
+static void work(unsigned long loops)
+{
+	volatile unsigned long x = 0;
+
+	while (loops--)
+		x += loops;
+}
+
+/* How many loops of work() take busy_us, at the current frequency */
+static void calibrate(int busy_us)
+{
+	unsigned long long t;
+	unsigned long loops = 1000;
+
+	for (;;) {
+		t = now_ns();
+		work(loops);
+		t = now_ns() - t;
+		if (t > 100000000ULL)
+			break;
+		loops *= 2;
+	}
+	loops_per_busy = (double)loops * busy_us * 1000 / t;
+	if (!loops_per_busy)
+		loops_per_busy = 1;
+}
+
+static void run_periodic(int period_ms, struct stats *st)
+{
+	unsigned long long period = period_ms * 1000000ULL;
+	struct timespec next;
+	int cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		next.tv_nsec += period;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL))
+			continue;
+
+		st->latency_ns += now_ns() - ts_ns(&next);
+		cpu = sched_getcpu();
+		if (cpu >= 0 && cpu < MAX_CPUS)
+			st->wakeups[cpu]++;
+
+		work(loops_per_busy);
+		st->jobs++;
+
+		/* Still at it when the next period began? */
+		if (now_ns() > ts_ns(&next) + period)
+			st->missed++;
+	}
+}
+
+/* Times @cpu entered an idle state so far, or -1 without cpuidle */
+static long long idle_entries(int cpu)
+{
+	long long sum = -1;
+	char name[128];
+	int state;
+
+	for (state = 0; state < MAX_STATES; state++) {
+		unsigned long long usage;
+		FILE *f;
+
+		snprintf(name, sizeof(name),
+			 "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/usage",
+			 cpu, state);
+		f = fopen(name, "r");
+		if (!f)
+			break;
+		if (fscanf(f, "%llu", &usage) == 1)
+			sum = (sum < 0 ? 0 : sum) + usage;
+		fclose(f);
+	}
+	return sum;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n tasks] [-p period_ms] [-b busy_us] "
+		"[-t secs]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, tasks = 4, period_ms = 10, busy_us = 1000, secs = 10;
+	long long idle_before[MAX_CPUS], idle_after;
+	unsigned long jobs = 0, missed = 0, wakeups;
+	unsigned long long latency_ns = 0;
+	int nr_cpus, cpu, i;
+	struct stats *stats;
+	pid_t *pids;
+
+	while ((opt = getopt(argc, argv, "n:p:b:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			tasks = atoi(optarg);
+			break;
+		case 'p':
+			period_ms = atoi(optarg);
+			break;
+		case 'b':
+			busy_us = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || tasks < 1 || period_ms < 1 || busy_us < 1 ||
+	    secs < 1)
+		usage(argv[0]);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpus > MAX_CPUS)
+		nr_cpus = MAX_CPUS;
+
+	calibrate(busy_us);
+
+	stats = mmap(NULL, tasks * sizeof(*stats), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED)
+		fatal("mmap");
+	pids = calloc(tasks, sizeof(*pids));
+	if (!pids)
+		fatal("calloc");
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		idle_before[cpu] = idle_entries(cpu);
+
+	for (i = 0; i < tasks; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			fatal("fork");
+		if (!pids[i]) {
+			run_periodic(period_ms, &stats[i]);
+			exit(0);
+		}
+	}
+
+	sleep(secs);
+
+	for (i = 0; i < tasks; i++)
+		kill(pids[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	printf("%d tasks, %d ms period, %d us work: ", tasks, period_ms,
+	       busy_us);
+	for (i = 0; i < tasks; i++) {
+		jobs += stats[i].jobs;
+		missed += stats[i].missed;
+		latency_ns += stats[i].latency_ns;
+	}
+	printf("%.0f jobs/s, %lu missed, %.1f us average wakeup latency\n",
+	       (double)jobs / secs, missed,
+	       jobs ? latency_ns / 1000.0 / jobs : 0.0);
+
+	printf("  cpu   wakeups/s  idle exits/s\n");
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		wakeups = 0;
+		for (i = 0; i < tasks; i++)
+			wakeups += stats[i].wakeups[cpu];
+
+		idle_after = idle_entries(cpu);
+		if (idle_before[cpu] < 0 || idle_after < 0)
+			printf("  %3d %11.1f %13s\n", cpu,
+			       (double)wakeups / secs, "-");
+		else
+			printf("  %3d %11.1f %13.1f\n", cpu,
+			       (double)wakeups / secs,
+			       (double)(idle_after - idle_before[cpu]) / secs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * sched-pingpong: measure wakeup placement with IPC ping-pong
+ *
+ * Runs pairs of processes that pass a token back and forth, the way a
+ * client and server talking over a pipe, a unix socket or binder do, and
+ * reports the round trips per second and where the wakeups ran: on the
+ * cpu of the task that woke them (sharing its caches) or elsewhere, and
+ * how often a task ran on a different cpu than at its previous wakeup.
+ *
+ *   sched-pingpong [-n pairs] [-w wakees] [-s] [-t secs]
+ *
+ *   -n pairs	number of independent ping-pong pairs (default 1)
+ *   -w wakees	instead of pairs, one waker feeding this many wakees at
+ *		once, each of which answers it (a 1:N pattern)
+ *   -s		use unix socketpairs instead of pipes
+ *   -t secs	seconds to run (default 5)
+ *
+ * Comparing a run with the IDLE_SIBLING and WAKE_WIDE scheduler features
+ * on and off (see /sys/kernel/debug/sched_features), together with the
+ * ttwu counters in /proc/schedstat, shows what wakeup placement does for
+ * these patterns.
+ *
+ * Released under the General Public License (GPL).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Side 0 and side 1 of a channel: each reads fd[side], writes wfd[side] */
+struct chan {
+	int fd[2];
+	int wfd[2];
+};
+
+struct stats {
+	unsigned long wakeups;
+	unsigned long local;
+	unsigned long migrations;
+};
+
+static int use_sockets;
+
+static void fatal(const char *x)
+{
+	perror(x);
+	exit(1);
+}
+
+static void chan_init(struct chan *c)
+{
+	int a[2], b[2];
+
+	if (use_sockets) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, c->fd))
+			fatal("socketpair");
+		c->wfd[0] = c->fd[0];
+		c->wfd[1] = c->fd[1];
+		return;
+	}
+
+	if (pipe(a) || pipe(b))
+		fatal("pipe");
+	c->fd[0] = a[0];
+	c->wfd[1] = a[1];
+	c->fd[1] = b[0];
+	c->wfd[0] = b[1];
+}
+
+static void send_cpu(int fd)
+{
+	int cpu = sched_getcpu();
+
+	if (write(fd, &cpu, sizeof(cpu)) != sizeof(cpu))
+		fatal("write");
+}
+
+/* Wait for the token and account where we woke up relative to its sender */
+static void recv_cpu(int fd, struct stats *st, int *last)
+{
+	int from, cpu;
+
+	if (read(fd, &from, sizeof(from)) != sizeof(from))
+		fatal("read");
+
+	cpu = sched_getcpu();
+	st->wakeups++;
+	if (cpu == from)
+		st->local++;
+	if (*last >= 0 && cpu != *last)
+		st->migrations++;
+	*last = cpu;
+}
+
+static void run_pair(struct chan *c, int side, struct stats *st)
+{
+	int last = -1;
+
+	if (side == 0)
+		send_cpu(c->wfd[0]);
+	for (;;) {
+		recv_cpu(c->fd[side], st, &last);
+		send_cpu(c->wfd[side]);
+	}
+}
+
+static void run_waker(struct chan *c, int wakees, struct stats *st)
+{
+	int last = -1, i;
+
+	for (;;) {
+		for (i = 0; i < wakees; i++)
+			send_cpu(c[i].wfd[0]);
+		for (i = 0; i < wakees; i++)
+			recv_cpu(c[i].fd[0], st, &last);
+	}
+}
+
+static pid_t spawn(void (*fn)(struct chan *, int, struct stats *),
+		   struct chan *c, int arg, struct stats *st)
+{
+	pid_t pid = fork();
+
+	if (pid < 0)
+		fatal("fork");
+	if (!pid) {
+		fn(c, arg, st);
+		exit(0);
+	}
+	return pid;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n pairs] [-w wakees] [-s] [-t secs]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, pairs = 1, wakees = 0, secs = 5, nr_tasks, i;
+	struct stats *stats, snap[2] = { { 0 } };
+	struct chan *chans;
+	pid_t *pids;
+
+	while ((opt = getopt(argc, argv, "n:w:st:")) != -1) {
+		switch (opt) {
+		case 'n':
+			pairs = atoi(optarg);
+			break;
+		case 'w':
+			wakees = atoi(optarg);
+			break;
+		case 's':
+			use_sockets = 1;
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || pairs < 1 || wakees < 0 || secs < 1)
+		usage(argv[0]);
+
+	nr_tasks = wakees ? wakees + 1 : 2 * pairs;
+	stats = mmap(NULL, nr_tasks * sizeof(*stats), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED)
+		fatal("mmap");
+	chans = calloc(wakees ? wakees : pairs, sizeof(*chans));
+	pids = calloc(nr_tasks, sizeof(*pids));
+	if (!chans || !pids)
+		fatal("calloc");
+
+	if (wakees) {
+		for (i = 0; i < wakees; i++) {
+			chan_init(&chans[i]);
+			pids[i + 1] = spawn(run_pair, &chans[i], 1,
+					    &stats[i + 1]);
+		}
+		pids[0] = spawn(run_waker, chans, wakees, &stats[0]);
+	} else {
+		for (i = 0; i < pairs; i++) {
+			chan_init(&chans[i]);
+			pids[2 * i + 1] = spawn(run_pair, &chans[i], 1,
+						&stats[2 * i + 1]);
+			pids[2 * i] = spawn(run_pair, &chans[i], 0,
+					    &stats[2 * i]);
+		}
+	}
+
+	sleep(secs);
+
+	/* [0] sums the wakers, [1] the wakees */
+	for (i = 0; i < nr_tasks; i++) {
+		struct stats *s = &snap[wakees ? i != 0 : i & 1];
+
+		s->wakeups += stats[i].wakeups;
+		s->local += stats[i].local;
+		s->migrations += stats[i].migrations;
+	}
+
+	for (i = 0; i < nr_tasks; i++)
+		kill(pids[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	if (wakees)
+		printf("1:%d %s: %.0f rounds/s\n", wakees,
+		       use_sockets ? "sockets" : "pipes",
+		       (double)snap[0].wakeups / wakees / secs);
+	else
+		printf("%d pairs %s: %.0f round trips/s\n", pairs,
+		       use_sockets ? "sockets" : "pipes",
+		       (double)snap[0].wakeups / secs);
+
+	for (i = 0; i < 2; i++)
+		printf("  %-7s %10lu wakeups, %5.1f%% on the waker's cpu, "
+		       "%lu cpu changes\n", i ? "wakees" : "wakers",
+		       snap[i].wakeups,
+		       snap[i].wakeups ? 100.0 * snap[i].local /
+					 snap[i].wakeups : 0.0,
+		       snap[i].migrations);
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * ra-replay: replay a file access trace to measure readahead
+ *
+ * Drops the page cache of a file, replays a trace of reads and mmap page
+ * touches against it, and reports how long that took and how much the
+ * kernel read from storage for it. Bytes read beyond the bytes requested is
+ * readahead that was wasted (or is still cached); time and major faults tell
+ * how much of it paid off.
+ *
+ *   ra-replay [-n runs] [-k] file trace
+ *
+ *   -n runs	replay the trace this many times (default 3)
+ *   -k		keep the page cache of the file between runs
+ *
+ * The trace holds one access per line, offsets and lengths in bytes:
+ *
+ *   r <offset> <length>	pread() of <length> bytes at <offset>
+ *   m <offset>		read one byte at <offset> through a mapping
+ *
+ * Lines starting with '#' are ignored. A trace of an application can be
+ * made from strace, e.g. for a pread heavy one:
+ *
+ *   strace -f -e trace=pread64 -o log app
+ *   awk -F'[(,)]' '/pread64/ { print "r", $5, $4 }' log > trace
+ *
+ * The read byte counts come from /proc/self/io, which needs
+ * CONFIG_TASK_IO_ACCOUNTING.
+ *
+ * Released under the General Public License (GPL).
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+struct access {
+	char op;
+	off_t offset;
+	size_t len;
+};
+
+static struct access *trace;
+static size_t nr_access;
+
+static void fatal(const char *x)
+{
+	perror(x);
+	exit(1);
+}
+
+static void load_trace(const char *name)
+{
+	char line[256];
+	size_t alloc = 0;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		fatal(name);
+
+	while (fgets(line, sizeof(line), f)) {
+		struct access a = { 0 };
+		unsigned long long offset, len = 1;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, " %c %llu %llu", &a.op, &offset, &len) < 2 ||
+		    (a.op != 'r' && a.op != 'm')) {
+			fprintf(stderr, "%s: bad line: %s", name, line);
+			exit(1);
+		}
+		a.offset = offset;
+		a.len = len;
+
+		if (nr_access == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			trace = realloc(trace, alloc * sizeof(*trace));
+			if (!trace)
+				fatal("realloc");
+		}
+		trace[nr_access++] = a;
+	}
+	fclose(f);
+}
+
+static unsigned long long read_bytes(void)
+{
+	unsigned long long val = 0;
+	char line[128];
+	FILE *f;
+
+	f = fopen("/proc/self/io", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "read_bytes: %llu", &val) == 1)
+			break;
+	fclose(f);
+	return val;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void replay(int fd, off_t size, int run, int keep)
+{
+	unsigned long long io, wanted = 0;
+	volatile unsigned char sum = 0;
+	struct rusage ru;
+	long majflt;
+	char *buf = NULL, *map = NULL;
+	size_t buf_len = 0, i;
+	double t;
+
+	if (!keep && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		fatal("posix_fadvise");
+
+	if (size) {
+		map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			fatal("mmap");
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt;
+	io = read_bytes();
+	t = now();
+
+	for (i = 0; i < nr_access; i++) {
+		struct access *a = &trace[i];
+
+		if (a->offset >= size)
+			continue;
+
+		if (a->op == 'm') {
+			sum += map[a->offset];
+			wanted += 1;
+			continue;
+		}
+
+		if (a->len > buf_len) {
+			buf_len = a->len;
+			buf = realloc(buf, buf_len);
+			if (!buf)
+				fatal("realloc");
+		}
+		if (pread(fd, buf, a->len, a->offset) < 0)
+			fatal("pread");
+		wanted += a->len;
+	}
+
+	t = now() - t;
+	io = read_bytes() - io;
+	getrusage(RUSAGE_SELF, &ru);
+	majflt = ru.ru_majflt - majflt;
+
+	printf("run %d: %zu accesses in %.3f s (%.0f/s), %llu KB wanted, "
+	       "%llu KB read (%.2fx), %ld major faults\n",
+	       run, nr_access, t, t ? nr_access / t : 0.0, wanted >> 10,
+	       io >> 10, wanted ? (double)io / wanted : 0.0, majflt);
+
+	if (map)
+		munmap(map, size);
+	free(buf);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n runs] [-k] file trace\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, runs = 3, keep = 0, fd, i;
+	struct stat st;
+
+	while ((opt = getopt(argc, argv, "n:k")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || runs < 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0)
+		fatal(argv[optind]);
+	if (fstat(fd, &st))
+		fatal("fstat");
+
+	load_trace(argv[optind + 1]);
+
+	for (i = 1; i <= runs; i++)
+		replay(fd, st.st_size, i, keep);
+
+	close(fd);
+	return 0;
+}
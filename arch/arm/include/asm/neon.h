@@ -0,0 +1,39 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+/*
+ * Copies of at least this many bytes are handed to the NEON routines
+ * by memcpy(), memset() and __copy_from_user().  Below this the cost
+ * of saving the user VFP context outweighs the faster block loop.
+ */
+#define NEON_COPY_THRESHOLD	1024
+
+#ifndef __ASSEMBLY__
+
+/*
+ * Kernel code may only use NEON registers between kernel_neon_begin()
+ * and kernel_neon_end().  The section runs with preemption disabled
+ * and must not be entered from interrupt context.
+ */
+extern void kernel_neon_begin(void);
+extern void kernel_neon_end(void);
+
+#ifdef CONFIG_NEON_KERNEL_COPY
+/* Non-zero once the boot CPU has been found to benefit from NEON copies. */
+extern int arm_neon_copy;
+
+extern void *memcpy_neon(void *dest, const void *src, size_t n);
+extern void *memset_neon(void *s, int c, size_t n);
+extern void copy_page_neon(void *to, const void *from);
+#endif
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* __ASM_ARM_NEON_H */
@@ -0,0 +1,125 @@
+/*
+ *  linux/arch/arm/lib/copy_neon_bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  Compare memcpy(), memset() and copy_page() throughput with the NEON
+ *  paths on and off.  Results are in MB/s and, when cpufreq knows the
+ *  current clock, in hundredths of a byte per cycle.  The module never
+ *  stays loaded, it returns -EAGAIN once the report is done.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/cpufreq.h>
+#include <asm/neon.h>
+#include <asm/page.h>
+
+#define BENCH_ORDER	4
+#define BENCH_BYTES	(8 * 1024 * 1024)
+
+enum bench_op { BENCH_MEMCPY, BENCH_MEMSET, BENCH_COPY_PAGE };
+
+static const char *bench_names[] = { "memcpy", "memset", "copy_page" };
+
+static u64 bench_run(enum bench_op op, void *dst, void *src, size_t size)
+{
+	unsigned long i, loops = BENCH_BYTES / size;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		switch (op) {
+		case BENCH_MEMCPY:
+			memcpy(dst, src, size);
+			break;
+		case BENCH_MEMSET:
+			memset(dst, i, size);
+			break;
+		case BENCH_COPY_PAGE:
+			copy_page(dst, src);
+			break;
+		}
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void bench_report(enum bench_op op, size_t size, int neon,
+			 u64 ns, unsigned int khz)
+{
+	u64 bytes = (BENCH_BYTES / size) * size;
+	u64 mbs, bpc = 0;
+
+	if (!ns)
+		ns = 1;
+	mbs = div64_u64(bytes * 1000, ns);
+	/* bytes per cycle * 100 = bytes * 1e8 / (ns * kHz) */
+	if (khz)
+		bpc = div64_u64(bytes * 100000000ULL, ns * khz);
+
+	printk(KERN_INFO "%-9s %6zu %-4s %6llu MB/s %3llu.%02llu bytes/cycle\n",
+	       bench_names[op], size, neon ? "neon" : "arm", mbs,
+	       bpc / 100, bpc % 100);
+}
+
+static void bench_size(enum bench_op op, void *dst, void *src, size_t size,
+		       unsigned int khz)
+{
+	int saved = arm_neon_copy;
+	int neon;
+	u64 ns;
+
+	for (neon = 0; neon <= saved; neon++) {
+		arm_neon_copy = neon;
+		/* warm the caches and TLB before timing */
+		bench_run(op, dst, src, size);
+		ns = bench_run(op, dst, src, size);
+		bench_report(op, size, neon, ns, khz);
+	}
+	arm_neon_copy = saved;
+}
+
+static int __init copy_neon_bench_init(void)
+{
+	unsigned long src, dst;
+	unsigned int khz;
+	size_t size;
+
+	src = __get_free_pages(GFP_KERNEL, BENCH_ORDER);
+	dst = __get_free_pages(GFP_KERNEL, BENCH_ORDER);
+	if (!src || !dst) {
+		free_pages(src, BENCH_ORDER);
+		free_pages(dst, BENCH_ORDER);
+		return -ENOMEM;
+	}
+	memset((void *)src, 0x5a, PAGE_SIZE << BENCH_ORDER);
+
+	khz = cpufreq_quick_get(raw_smp_processor_id());
+	if (!arm_neon_copy)
+		printk(KERN_INFO "copy_neon_bench: NEON copies disabled, "
+		       "reporting ARM routines only\n");
+
+	for (size = 64; size <= (PAGE_SIZE << BENCH_ORDER); size <<= 1)
+		bench_size(BENCH_MEMCPY, (void *)dst, (void *)src, size, khz);
+	for (size = 64; size <= (PAGE_SIZE << BENCH_ORDER); size <<= 1)
+		bench_size(BENCH_MEMSET, (void *)dst, (void *)src, size, khz);
+	bench_size(BENCH_COPY_PAGE, (void *)dst, (void *)src, PAGE_SIZE, khz);
+
+	free_pages(src, BENCH_ORDER);
+	free_pages(dst, BENCH_ORDER);
+	return -EAGAIN;
+}
+
+static void __exit copy_neon_bench_exit(void) { }
+
+module_init(copy_neon_bench_init);
+module_exit(copy_neon_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("NEON memory copy benchmark");
@@ -0,0 +1,130 @@
+/*
+ *  linux/arch/arm/lib/copy_neon_glue.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  memcpy(), memset() and copy_page() branch here for large sizes when
+ *  CONFIG_NEON_KERNEL_COPY is set.  The NEON loops in copy_neon.S only
+ *  handle whole 64 byte blocks; the remainder, and any call made before
+ *  the CPU has been identified or from interrupt context, goes to the
+ *  original ARM implementations.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/hardirq.h>
+#include <asm/cputype.h>
+#include <asm/hwcap.h>
+#include <asm/neon.h>
+
+/*
+ * Bound the time spent with preemption disabled by a single
+ * kernel_neon_begin() section.
+ */
+#define NEON_COPY_CHUNK		(16 * 1024)
+
+extern size_t __memcpy_neon(void *dest, const void *src, size_t n);
+extern size_t __memset_neon(void *s, int c, size_t n);
+extern void __copy_page_neon(void *to, const void *from);
+
+extern void *__memcpy_std(void *dest, const void *src, size_t n);
+extern void *__memset_std(void *s, int c, size_t n);
+extern void __copy_page_std(void *to, const void *from);
+
+int arm_neon_copy __read_mostly;
+EXPORT_SYMBOL_GPL(arm_neon_copy);
+
+static int neon_copy_disabled __initdata;
+
+static inline int neon_copy_usable(void)
+{
+	return arm_neon_copy && !in_interrupt();
+}
+
+void *memcpy_neon(void *dest, const void *src, size_t n)
+{
+	void *d = dest;
+	size_t done;
+
+	if (!neon_copy_usable())
+		return __memcpy_std(dest, src, n);
+
+	while (n >= 64) {
+		kernel_neon_begin();
+		done = __memcpy_neon(d, src, min_t(size_t, n, NEON_COPY_CHUNK));
+		kernel_neon_end();
+		d += done;
+		src += done;
+		n -= done;
+	}
+	if (n)
+		__memcpy_std(d, src, n);
+	return dest;
+}
+
+void *memset_neon(void *s, int c, size_t n)
+{
+	void *d = s;
+	size_t done;
+
+	if (!neon_copy_usable())
+		return __memset_std(s, c, n);
+
+	while (n >= 64) {
+		kernel_neon_begin();
+		done = __memset_neon(d, c, min_t(size_t, n, NEON_COPY_CHUNK));
+		kernel_neon_end();
+		d += done;
+		n -= done;
+	}
+	if (n)
+		__memset_std(d, c, n);
+	return s;
+}
+
+void copy_page_neon(void *to, const void *from)
+{
+	if (!neon_copy_usable()) {
+		__copy_page_std(to, from);
+		return;
+	}
+
+	kernel_neon_begin();
+	__copy_page_neon(to, from);
+	kernel_neon_end();
+}
+
+static int __init noneoncopy_setup(char *str)
+{
+	neon_copy_disabled = 1;
+	return 1;
+}
+__setup("noneoncopy", noneoncopy_setup);
+
+/*
+ * Only enable the NEON paths on cores where they have been measured to
+ * beat the LDM/STM loops; on others the VFP context switch makes them
+ * a loss.  Runs after vfp_init() has set HWCAP_NEON.
+ */
+static int __init neon_copy_init(void)
+{
+	unsigned int id = read_cpuid_id();
+
+	if (neon_copy_disabled || !(elf_hwcap & HWCAP_NEON))
+		return 0;
+
+	switch (id & 0xff00fff0) {
+	case 0x4100c080:	/* ARM Cortex-A8 */
+	case 0x4100c090:	/* ARM Cortex-A9 */
+	case 0x510000f0:	/* Qualcomm Scorpion */
+	case 0x510002d0:	/* Qualcomm Scorpion, dual core */
+		arm_neon_copy = 1;
+		printk(KERN_INFO "NEON: using NEON for copies of %d bytes "
+		       "or more\n", NEON_COPY_THRESHOLD);
+		break;
+	}
+	return 0;
+}
+late_initcall_sync(neon_copy_init);
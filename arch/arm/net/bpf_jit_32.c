@@ -0,0 +1,708 @@
+/*
+ * Just-In-Time compiler for BPF filters on 32bit ARM
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ */
+
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+#include <linux/log2.h>
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/filter.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+#include <asm/unaligned.h>
+
+#include "bpf_jit_32.h"
+
+/*
+ * ABI:
+ *
+ * r0	scratch register, first helper argument and return value
+ * r1	offset of the current packet load, second helper argument
+ * r3	scratch register for helper addresses and byte loads
+ * r4	A register
+ * r5	X register
+ * r6	pointer to the skb
+ * r7	skb->data
+ * r8	skb_headlen(skb)
+ *
+ * The BPF scratch memory lives on the stack.
+ */
+
+#define r_scratch	ARM_R0
+#define r_off		ARM_R1
+#define r_tmp		ARM_R3
+#define r_A		ARM_R4
+#define r_X		ARM_R5
+#define r_skb		ARM_R6
+#define r_skb_data	ARM_R7
+#define r_skb_hl	ARM_R8
+
+/* the u64 returned by the load helpers: error in the high word */
+#ifdef __ARMEB__
+#define r_ret_err	ARM_R0
+#define r_ret_val	ARM_R1
+#else
+#define r_ret_val	ARM_R0
+#define r_ret_err	ARM_R1
+#endif
+
+#define SEEN_MEM	(1 << 0)	/* uses the BPF scratch memory */
+#define SEEN_DATA	(1 << 1)	/* loads from the packet */
+
+#define SCRATCH_SIZE	(BPF_MEMWORDS * 4)
+#define SCRATCH_OFF(k)	((k) * 4)
+
+#define SAVED_REGS	(1 << r_A | 1 << r_X | 1 << r_skb | \
+			 1 << r_skb_data | 1 << r_skb_hl)
+
+#if __LINUX_ARM_ARCH__ >= 7
+#define MOV_FIXED_INSNS	2
+#else
+#define MOV_FIXED_INSNS	4
+#endif
+
+#if __LINUX_ARM_ARCH__ >= 5
+#define CALL_INSNS	1
+#else
+#define CALL_INSNS	2
+#endif
+
+/* mov r0, skb; helper address; call; cmp; error return; mov dst */
+#define LOAD_SLOW_INSNS	(1 + MOV_FIXED_INSNS + CALL_INSNS + 1 + 2 + 1)
+
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+struct jit_ctx {
+	const struct sk_filter *skf;
+	unsigned idx;
+	unsigned epilogue_offset;	/* in bytes */
+	u32 seen;
+	u32 *offsets;			/* start of each BPF insn, in bytes */
+	u32 *target;
+};
+
+/*
+ * Slow path packet loads.  They go through bpf_load_pointer() so that
+ * non-linear skbs and SKF_NET_OFF/SKF_LL_OFF offsets behave as in
+ * sk_run_filter().  A non-zero high word means the load failed.
+ */
+static u64 jit_get_skb_b(struct sk_buff *skb, int offset)
+{
+	u8 tmp, *ptr;
+
+	ptr = bpf_load_pointer(skb, offset, 1, &tmp);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return *ptr;
+}
+
+static u64 jit_get_skb_h(struct sk_buff *skb, int offset)
+{
+	u16 tmp;
+	void *ptr;
+
+	ptr = bpf_load_pointer(skb, offset, 2, &tmp);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return get_unaligned_be16(ptr);
+}
+
+static u64 jit_get_skb_w(struct sk_buff *skb, int offset)
+{
+	u32 tmp;
+	void *ptr;
+
+	ptr = bpf_load_pointer(skb, offset, 4, &tmp);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return get_unaligned_be32(ptr);
+}
+
+/* protocol and pkt_type are bitfields, let the compiler extract them */
+static u32 jit_get_protocol(struct sk_buff *skb)
+{
+	return ntohs(skb->protocol);
+}
+
+static u32 jit_get_pkttype(struct sk_buff *skb)
+{
+	return skb->pkt_type;
+}
+
+/* most ARM cores have no divide instruction */
+static u32 jit_udiv(u32 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline void _emit(int cond, u32 inst, struct jit_ctx *ctx)
+{
+	if (ctx->target != NULL)
+		ctx->target[ctx->idx] = inst | (cond << 28);
+
+	ctx->idx++;
+}
+
+/*
+ * Emit an instruction that will be executed unconditionally.
+ */
+static inline void emit(u32 inst, struct jit_ctx *ctx)
+{
+	_emit(ARM_COND_AL, inst, ctx);
+}
+
+/*
+ * Return the 12bit "modified immediate" encoding of x, or -1 if x is
+ * not an 8bit value rotated right by an even amount.
+ */
+static int imm8m(u32 x)
+{
+	u32 rot;
+
+	for (rot = 0; rot < 16; rot++)
+		if ((x & ~ror32(0xff, 2 * rot)) == 0)
+			return rol32(x, 2 * rot) | (rot << 8);
+
+	return -1;
+}
+
+static void emit_mov_i_no8m(int rd, u32 val, struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 7
+	int first = 1;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		u32 byte = val & (0xff << shift);
+
+		if (!byte)
+			continue;
+		if (first)
+			emit(ARM_MOV_I(rd, imm8m(byte)), ctx);
+		else
+			emit(ARM_ORR_I(rd, rd, imm8m(byte)), ctx);
+		first = 0;
+	}
+#else
+	emit(ARM_MOVW(rd, val & 0xffff), ctx);
+	if (val > 0xffff)
+		emit(ARM_MOVT(rd, val >> 16), ctx);
+#endif
+}
+
+static void emit_mov_i(int rd, u32 val, struct jit_ctx *ctx)
+{
+	int imm12 = imm8m(val);
+
+	if (imm12 >= 0) {
+		emit(ARM_MOV_I(rd, imm12), ctx);
+		return;
+	}
+	imm12 = imm8m(~val);
+	if (imm12 >= 0) {
+		emit(ARM_MVN_I(rd, imm12), ctx);
+		return;
+	}
+	emit_mov_i_no8m(rd, val, ctx);
+}
+
+/*
+ * Always MOV_FIXED_INSNS long, so that the slow path of a packet load
+ * has a known size and the fast path can branch over it.
+ */
+static void emit_mov_fixed(int rd, u32 val, struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 7
+	emit(ARM_MOV_I(rd, imm8m(val & 0xff)), ctx);
+	emit(ARM_ORR_I(rd, rd, imm8m(val & 0xff00)), ctx);
+	emit(ARM_ORR_I(rd, rd, imm8m(val & 0xff0000)), ctx);
+	emit(ARM_ORR_I(rd, rd, imm8m(val & 0xff000000)), ctx);
+#else
+	emit(ARM_MOVW(rd, val & 0xffff), ctx);
+	emit(ARM_MOVT(rd, val >> 16), ctx);
+#endif
+}
+
+static void emit_call(int rn, struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 5
+	emit(ARM_MOV_R(ARM_LR, ARM_PC), ctx);
+	emit(ARM_MOV_R(ARM_PC, rn), ctx);
+#else
+	emit(ARM_BLX_R(rn), ctx);
+#endif
+}
+
+/*
+ * Branch offset from the current instruction to byte offset tgt.  The
+ * offsets are only known once the image has been sized.
+ */
+static inline u32 b_imm(unsigned tgt, struct jit_ctx *ctx)
+{
+	if (ctx->target == NULL)
+		return 0;
+
+	return ((s32)tgt - (s32)(ctx->idx * 4 + 8)) >> 2;
+}
+
+static inline u32 b_insn(unsigned insn, struct jit_ctx *ctx)
+{
+	return b_imm(ctx->offsets[insn], ctx);
+}
+
+static inline void emit_err_ret(u8 cond, struct jit_ctx *ctx)
+{
+	_emit(cond, ARM_MOV_I(ARM_R0, 0), ctx);
+	_emit(cond, ARM_B(b_imm(ctx->epilogue_offset, ctx)), ctx);
+}
+
+#define OP_IMM3(op, r1, r2, imm_val, ctx)				\
+	do {								\
+		imm12 = imm8m(imm_val);					\
+		if (imm12 < 0) {					\
+			emit_mov_i_no8m(r_scratch, imm_val, ctx);	\
+			emit(op ## _R((r1), (r2), r_scratch), ctx);	\
+		} else {						\
+			emit(op ## _I((r1), (r2), imm12), ctx);		\
+		}							\
+	} while (0)
+
+static void build_prologue(struct jit_ctx *ctx)
+{
+	emit(ARM_PUSH(SAVED_REGS | 1 << ARM_LR), ctx);
+
+	if (ctx->seen & SEEN_MEM)
+		emit(ARM_SUB_I(ARM_SP, ARM_SP, imm8m(SCRATCH_SIZE)), ctx);
+
+	emit(ARM_MOV_R(r_skb, ARM_R0), ctx);
+	emit(ARM_MOV_I(r_A, 0), ctx);
+	emit(ARM_MOV_I(r_X, 0), ctx);
+
+	if (ctx->seen & SEEN_DATA) {
+		emit(ARM_LDR_I(r_skb_data, r_skb,
+			       offsetof(struct sk_buff, data)), ctx);
+		/* headlen = len - data_len */
+		emit(ARM_LDR_I(r_scratch, r_skb,
+			       offsetof(struct sk_buff, len)), ctx);
+		emit(ARM_LDR_I(r_off, r_skb,
+			       offsetof(struct sk_buff, data_len)), ctx);
+		emit(ARM_SUB_R(r_skb_hl, r_scratch, r_off), ctx);
+	}
+}
+
+static void build_epilogue(struct jit_ctx *ctx)
+{
+	if (ctx->seen & SEEN_MEM)
+		emit(ARM_ADD_I(ARM_SP, ARM_SP, imm8m(SCRATCH_SIZE)), ctx);
+
+	emit(ARM_POP(SAVED_REGS | 1 << ARM_PC), ctx);
+}
+
+/*
+ * Load size bytes at offset r_off into dst.  Loads that fit in the
+ * linear part of the skb are done inline, byte by byte since packet
+ * data is rarely aligned; anything else calls func.
+ */
+static void emit_load(unsigned int size, int dst, void *func,
+		      struct jit_ctx *ctx)
+{
+	unsigned int i;
+
+	ctx->seen |= SEEN_DATA;
+
+	/* fast path if size <= headlen && offset <= headlen - size */
+	emit(ARM_SUBS_I(r_scratch, r_skb_hl, size), ctx);
+	_emit(ARM_COND_HS, ARM_CMP_R(r_scratch, r_off), ctx);
+	_emit(ARM_COND_HS, ARM_ADD_R(r_scratch, r_skb_data, r_off), ctx);
+	_emit(ARM_COND_HS, ARM_LDRB_I(dst, r_scratch, 0), ctx);
+	for (i = 1; i < size; i++) {
+		_emit(ARM_COND_HS, ARM_LDRB_I(r_tmp, r_scratch, i), ctx);
+		_emit(ARM_COND_HS,
+		      ARM_ORR_S(dst, r_tmp, dst, SRTYPE_LSL, 8), ctx);
+	}
+	_emit(ARM_COND_HS, ARM_B(LOAD_SLOW_INSNS - 1), ctx);
+
+	/* the slow path, the offset is already in r1 */
+	emit(ARM_MOV_R(ARM_R0, r_skb), ctx);
+	emit_mov_fixed(r_tmp, (u32)func, ctx);
+	emit_call(r_tmp, ctx);
+	emit(ARM_CMP_I(r_ret_err, 0), ctx);
+	emit_err_ret(ARM_COND_NE, ctx);
+	emit(ARM_MOV_R(dst, r_ret_val), ctx);
+}
+
+/* A = func(skb) */
+static void emit_skb_helper(void *func, struct jit_ctx *ctx)
+{
+	emit(ARM_MOV_R(ARM_R0, r_skb), ctx);
+	emit_mov_fixed(r_tmp, (u32)func, ctx);
+	emit_call(r_tmp, ctx);
+	emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+}
+
+static int emit_ancillary(int anc, struct jit_ctx *ctx)
+{
+	switch (anc) {
+	case SKF_AD_PROTOCOL:
+		emit_skb_helper(jit_get_protocol, ctx);
+		break;
+	case SKF_AD_PKTTYPE:
+		emit_skb_helper(jit_get_pkttype, ctx);
+		break;
+	case SKF_AD_IFINDEX:
+		emit(ARM_LDR_I(r_scratch, r_skb,
+			       offsetof(struct sk_buff, dev)), ctx);
+		emit(ARM_CMP_I(r_scratch, 0), ctx);
+		emit_err_ret(ARM_COND_EQ, ctx);
+		emit(ARM_LDR_I(r_A, r_scratch,
+			       offsetof(struct net_device, ifindex)), ctx);
+		break;
+	case SKF_AD_NLATTR:
+	case SKF_AD_NLATTR_NEST:
+		/* only used on netlink sockets, leave them to the interpreter */
+		return -1;
+	default:
+		/* unknown ancillary data, sk_run_filter() drops the packet */
+		emit_err_ret(ARM_COND_AL, ctx);
+		break;
+	}
+	return 0;
+}
+
+static int build_body(struct jit_ctx *ctx)
+{
+	const struct sk_filter *prog = ctx->skf;
+	const struct sock_filter *inst;
+	unsigned i, load_size;
+	void *load_func;
+	int imm12;
+	u8 condt;
+	u32 k;
+
+	for (i = 0; i < prog->len; i++) {
+		inst = &(prog->insns[i]);
+		k = inst->k;
+
+		ctx->offsets[i] = ctx->idx * 4;
+
+		switch (inst->code) {
+		case BPF_LD|BPF_IMM:
+			emit_mov_i(r_A, k, ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			emit(ARM_LDR_I(r_A, r_skb,
+				       offsetof(struct sk_buff, len)), ctx);
+			break;
+		case BPF_LD|BPF_MEM:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_LDR_I(r_A, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+			load_size = 4;
+			load_func = jit_get_skb_w;
+			goto load_abs;
+		case BPF_LD|BPF_H|BPF_ABS:
+			load_size = 2;
+			load_func = jit_get_skb_h;
+			goto load_abs;
+		case BPF_LD|BPF_B|BPF_ABS:
+			load_size = 1;
+			load_func = jit_get_skb_b;
+load_abs:
+			if ((int)k >= SKF_AD_OFF && (int)k < 0) {
+				if (emit_ancillary((int)k - SKF_AD_OFF, ctx))
+					return -1;
+				break;
+			}
+			emit_mov_i(r_off, k, ctx);
+			emit_load(load_size, r_A, load_func, ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_IND:
+			load_size = 4;
+			load_func = jit_get_skb_w;
+			goto load_ind;
+		case BPF_LD|BPF_H|BPF_IND:
+			load_size = 2;
+			load_func = jit_get_skb_h;
+			goto load_ind;
+		case BPF_LD|BPF_B|BPF_IND:
+			load_size = 1;
+			load_func = jit_get_skb_b;
+load_ind:
+			/*
+			 * Unlike sk_run_filter(), an X + k that lands in the
+			 * ancillary area is treated as a failed load.
+			 */
+			OP_IMM3(ARM_ADD, r_off, r_X, k, ctx);
+			emit_load(load_size, r_A, load_func, ctx);
+			break;
+		case BPF_LDX|BPF_IMM:
+			emit_mov_i(r_X, k, ctx);
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			emit(ARM_LDR_I(r_X, r_skb,
+				       offsetof(struct sk_buff, len)), ctx);
+			break;
+		case BPF_LDX|BPF_MEM:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_LDR_I(r_X, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_LDX|BPF_B|BPF_MSH:
+			/* x = ((*(frame + k)) & 0xf) << 2; */
+			emit_mov_i(r_off, k, ctx);
+			emit_load(1, r_X, jit_get_skb_b, ctx);
+			emit(ARM_AND_I(r_X, r_X, 0x0f), ctx);
+			emit(ARM_LSL_I(r_X, r_X, 2), ctx);
+			break;
+		case BPF_ST:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_STR_I(r_A, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_STX:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_STR_I(r_X, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			OP_IMM3(ARM_ADD, r_A, r_A, k, ctx);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			emit(ARM_ADD_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			OP_IMM3(ARM_SUB, r_A, r_A, k, ctx);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			emit(ARM_SUB_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_MUL(r_A, r_A, r_scratch), ctx);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			emit(ARM_MUL(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			/* sk_chk_filter() has rejected k == 0 */
+			if (k == 1)
+				break;
+			if (is_power_of_2(k)) {
+				emit(ARM_LSR_I(r_A, r_A, ilog2(k)), ctx);
+				break;
+			}
+			emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+			emit_mov_i(ARM_R1, k, ctx);
+			goto div;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			emit(ARM_CMP_I(r_X, 0), ctx);
+			emit_err_ret(ARM_COND_EQ, ctx);
+			emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+			emit(ARM_MOV_R(ARM_R1, r_X), ctx);
+div:
+			emit_mov_fixed(r_tmp, (u32)jit_udiv, ctx);
+			emit_call(r_tmp, ctx);
+			emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			OP_IMM3(ARM_ORR, r_A, r_A, k, ctx);
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:
+			emit(ARM_ORR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_AND|BPF_K:
+			OP_IMM3(ARM_AND, r_A, r_A, k, ctx);
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:
+			emit(ARM_AND_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			if (k == 0)
+				break;
+			if (k < 32) {
+				emit(ARM_LSL_I(r_A, r_A, k), ctx);
+				break;
+			}
+			/* same result as the interpreter's register shift */
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_LSL_R(r_A, r_A, r_scratch), ctx);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			emit(ARM_LSL_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			/* LSR #0 would encode a shift by 32 */
+			if (k == 0)
+				break;
+			if (k < 32) {
+				emit(ARM_LSR_I(r_A, r_A, k), ctx);
+				break;
+			}
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_LSR_R(r_A, r_A, r_scratch), ctx);
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			emit(ARM_LSR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_NEG:
+			emit(ARM_RSB_I(r_A, r_A, 0), ctx);
+			break;
+		case BPF_JMP|BPF_JA:
+			emit(ARM_B(b_insn(i + k + 1, ctx)), ctx);
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			condt = ARM_COND_EQ;
+			goto cmp_imm;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			condt = ARM_COND_HI;
+			goto cmp_imm;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			condt = ARM_COND_HS;
+cmp_imm:
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(r_scratch, k, ctx);
+				emit(ARM_CMP_R(r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_CMP_I(r_A, imm12), ctx);
+			}
+cond_jump:
+			if (inst->jt)
+				_emit(condt, ARM_B(b_insn(i + inst->jt + 1,
+							  ctx)), ctx);
+			if (inst->jf)
+				_emit(condt ^ 1, ARM_B(b_insn(i + inst->jf + 1,
+							      ctx)), ctx);
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			condt = ARM_COND_EQ;
+			goto cmp_x;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			condt = ARM_COND_HI;
+			goto cmp_x;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			condt = ARM_COND_HS;
+cmp_x:
+			emit(ARM_CMP_R(r_A, r_X), ctx);
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			condt = ARM_COND_NE;
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(r_scratch, k, ctx);
+				emit(ARM_TST_R(r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_TST_I(r_A, imm12), ctx);
+			}
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			condt = ARM_COND_NE;
+			emit(ARM_TST_R(r_A, r_X), ctx);
+			goto cond_jump;
+		case BPF_MISC|BPF_TAX:
+			emit(ARM_MOV_R(r_X, r_A), ctx);
+			break;
+		case BPF_MISC|BPF_TXA:
+			emit(ARM_MOV_R(r_A, r_X), ctx);
+			break;
+		case BPF_RET|BPF_K:
+			emit_mov_i(ARM_R0, k, ctx);
+			goto ret;
+		case BPF_RET|BPF_A:
+			emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+ret:
+			/* the last return falls through into the epilogue */
+			if (i != prog->len - 1)
+				emit(ARM_B(b_imm(ctx->epilogue_offset, ctx)),
+				     ctx);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	struct jit_ctx ctx;
+	unsigned alloc_size;
+
+	BUILD_BUG_ON(sizeof(struct sk_buff) > 4095);
+	BUILD_BUG_ON(offsetof(struct net_device, ifindex) > 4095);
+
+	if (!bpf_jit_enable)
+		return;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.skf = fp;
+	ctx.offsets = kzalloc(4 * ctx.skf->len, GFP_KERNEL);
+	if (ctx.offsets == NULL)
+		return;
+
+	/* find out what the prologue has to set up */
+	if (build_body(&ctx))
+		goto out;
+
+	/* size the image and record where each instruction starts */
+	ctx.idx = 0;
+	build_prologue(&ctx);
+	build_body(&ctx);
+	ctx.epilogue_offset = ctx.idx * 4;
+	build_epilogue(&ctx);
+
+	alloc_size = 4 * ctx.idx;
+	/* bpf_jit_free() reuses the image for its work_struct */
+	ctx.target = module_alloc(max_t(unsigned, alloc_size,
+					sizeof(struct work_struct)));
+	if (unlikely(ctx.target == NULL))
+		goto out;
+
+	ctx.idx = 0;
+	build_prologue(&ctx);
+	build_body(&ctx);
+	build_epilogue(&ctx);
+
+	flush_icache_range((u32)ctx.target, (u32)(ctx.target + ctx.idx));
+
+	if (bpf_jit_enable > 1)
+		print_hex_dump(KERN_INFO, "BPF JIT code: ",
+			       DUMP_PREFIX_ADDRESS, 16, 4, ctx.target,
+			       alloc_size, false);
+
+	fp->bpf_func = (void *)ctx.target;
+out:
+	kfree(ctx.offsets);
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void bpf_jit_free_worker(struct work_struct *work)
+{
+	module_free(NULL, work);
+}
+
+void bpf_jit_free(struct sk_filter *fp)
+{
+	struct work_struct *work;
+
+	if (fp->bpf_func == NULL)
+		return;
+
+	/*
+	 * Filters are usually released from an RCU callback, where
+	 * module_free() may not be called.
+	 */
+	work = (struct work_struct *)fp->bpf_func;
+	INIT_WORK(work, bpf_jit_free_worker);
+	schedule_work(work);
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
@@ -14,8 +14,10 @@
 #include <linux/signal.h>
 #include <linux/sched.h>
 #include <linux/init.h>
+#include <linux/hardirq.h>
 
 #include <asm/thread_notify.h>
+#include <asm/neon.h>
 #include <asm/vfp.h>
 
 #include "vfpinstr.h"
@@ -430,6 +432,47 @@ out:
 }
 #endif
 
+#ifdef CONFIG_NEON
+/*
+ * Kernel-mode NEON support.  Whatever VFP state is live in the
+ * hardware is saved to its owner and last_VFP_context is cleared, so
+ * the owning thread reloads its registers on its next VFP instruction.
+ * VFP is left disabled by kernel_neon_end() for the same reason.
+ */
+void kernel_neon_begin(void)
+{
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC);
+	fmxr(FPEXC, fpexc | FPEXC_EN);
+
+#ifdef CONFIG_SMP
+	/*
+	 * With VFP disabled the registers were already saved when the
+	 * owner was switched out; otherwise they belong to current.
+	 */
+	if ((fpexc & FPEXC_EN) && last_VFP_context[cpu])
+		vfp_save_state(last_VFP_context[cpu], fpexc);
+#else
+	if (last_VFP_context[cpu])
+		vfp_save_state(last_VFP_context[cpu], fpexc);
+#endif
+	last_VFP_context[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+#endif
+
 #include <linux/smp.h>
 
 /*
@@ -0,0 +1,227 @@
+/*
+ * Random read IOPS benchmark
+ *
+ * Runs 4k random reads against the block device named by dev= from 1, 2,
+ * 4, ... kernel threads, each bound to its own CPU and keeping depth= bios
+ * in flight, and reports the IOPS for each thread count. Comparing a device
+ * loaded with and without use_mq shows how submission scales with CPUs.
+ *
+ *   modprobe brd rd_size=262144 use_mq=1
+ *   modprobe blk-mq-bench dev=/dev/ram0 secs=5
+ *
+ * Only reads are issued, so it is safe on a device with data on it. The
+ * module never stays loaded, it returns -EAGAIN once the report is done.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+
+#define BENCH_SHIFT	12
+#define BENCH_BS	(1 << BENCH_SHIFT)
+
+static char *dev = "/dev/ram0";
+module_param(dev, charp, 0);
+MODULE_PARM_DESC(dev, "Block device to read from");
+
+static unsigned int secs = 5;
+module_param(secs, uint, 0);
+MODULE_PARM_DESC(secs, "Seconds per run");
+
+static unsigned int depth = 32;
+module_param(depth, uint, 0);
+MODULE_PARM_DESC(depth, "Bios in flight per thread");
+
+static unsigned int max_threads;
+module_param(max_threads, uint, 0);
+MODULE_PARM_DESC(max_threads, "Most submitting threads (default: online CPUs)");
+
+struct bench_thread {
+	struct block_device	*bdev;
+	unsigned int		nr_blocks;
+	unsigned long		end;
+	struct page		*page;
+
+	atomic_t		inflight;
+	atomic_t		errors;
+	atomic_t		done;
+	wait_queue_head_t	wait;
+
+	/*
+	 * One reference for the thread and one for each bio in flight.
+	 * Whoever drops the last signals exited, after which the thread
+	 * and its bios are done with this structure.
+	 */
+	atomic_t		refs;
+	struct completion	exited;
+};
+
+static void bench_put(struct bench_thread *t)
+{
+	if (atomic_dec_and_test(&t->refs))
+		complete(&t->exited);
+}
+
+static void bench_end_io(struct bio *bio, int err)
+{
+	struct bench_thread *t = bio->bi_private;
+
+	if (err)
+		atomic_inc(&t->errors);
+	else
+		atomic_inc(&t->done);
+	bio_put(bio);
+
+	atomic_dec(&t->inflight);
+	wake_up(&t->wait);
+	bench_put(t);
+}
+
+static int bench_submit(struct bench_thread *t)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = t->bdev;
+	bio->bi_sector = (sector_t)(random32() % t->nr_blocks) <<
+				(BENCH_SHIFT - 9);
+	bio->bi_end_io = bench_end_io;
+	bio->bi_private = t;
+	bio_add_page(bio, t->page, BENCH_BS, 0);
+
+	atomic_inc(&t->refs);
+	atomic_inc(&t->inflight);
+	submit_bio(READ, bio);
+	return 0;
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+
+	while (time_before(jiffies, t->end)) {
+		while (atomic_read(&t->inflight) < depth) {
+			if (bench_submit(t))
+				break;
+		}
+		wait_event(t->wait, atomic_read(&t->inflight) < depth);
+	}
+
+	/* the last bio to complete signals exited if we're not last */
+	bench_put(t);
+	return 0;
+}
+
+static void bench_run(struct block_device *bdev, unsigned int nr_blocks,
+		      unsigned int nr_threads)
+{
+	struct bench_thread *threads;
+	struct task_struct *task;
+	unsigned long ios = 0, end;
+	unsigned int i, cpu, started = 0;
+	int errors = 0;
+
+	threads = kcalloc(nr_threads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return;
+
+	end = jiffies + secs * HZ;
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nr_threads; i++) {
+		struct bench_thread *t = &threads[i];
+
+		t->bdev = bdev;
+		t->nr_blocks = nr_blocks;
+		t->end = end;
+		atomic_set(&t->inflight, 0);
+		atomic_set(&t->errors, 0);
+		atomic_set(&t->done, 0);
+		atomic_set(&t->refs, 1);
+		init_waitqueue_head(&t->wait);
+		init_completion(&t->exited);
+
+		t->page = alloc_page(GFP_KERNEL);
+		if (!t->page)
+			break;
+
+		task = kthread_create(bench_thread_fn, t, "mq_bench/%u", cpu);
+		if (IS_ERR(task)) {
+			__free_page(t->page);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&threads[i].exited);
+		ios += atomic_read(&threads[i].done);
+		errors += atomic_read(&threads[i].errors);
+		__free_page(threads[i].page);
+	}
+
+	if (started)
+		printk(KERN_INFO "blk-mq-bench: %s %2u threads qd %u: "
+		       "%lu IOPS%s\n", dev, started, depth, ios / secs,
+		       errors ? " (I/O errors)" : "");
+	kfree(threads);
+}
+
+static int __init blk_mq_bench_init(void)
+{
+	struct block_device *bdev;
+	unsigned int nr_blocks;
+	unsigned int n, threads;
+
+	if (!secs || !depth)
+		return -EINVAL;
+
+	bdev = open_bdev_exclusive(dev, FMODE_READ, blk_mq_bench_init);
+	if (IS_ERR(bdev)) {
+		printk(KERN_ERR "blk-mq-bench: can't open %s\n", dev);
+		return PTR_ERR(bdev);
+	}
+
+	nr_blocks = min_t(loff_t, i_size_read(bdev->bd_inode) >> BENCH_SHIFT,
+			  UINT_MAX);
+	if (!nr_blocks) {
+		close_bdev_exclusive(bdev, FMODE_READ);
+		return -ENOSPC;
+	}
+
+	threads = max_threads ? max_threads : num_online_cpus();
+	for (n = 1; n < threads; n <<= 1)
+		bench_run(bdev, nr_blocks, n);
+	bench_run(bdev, nr_blocks, threads);
+
+	close_bdev_exclusive(bdev, FMODE_READ);
+	return -EAGAIN;
+}
+
+static void __exit blk_mq_bench_exit(void) { }
+
+module_init(blk_mq_bench_init);
+module_exit(blk_mq_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Block device random read IOPS benchmark");
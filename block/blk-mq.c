@@ -0,0 +1,555 @@
+/*
+ * Multi-queue request submission
+ *
+ * Requests are allocated from a per hardware queue tag space and staged on
+ * a per-cpu software queue, so submitters on different CPUs never touch a
+ * shared lock on the way in. Whoever finds the hardware queue idle splices
+ * the software queues of all CPUs mapped to it and feeds the driver; the
+ * others just leave their requests behind and return. There is no elevator
+ * and no queue plugging in this mode.
+ *
+ * Nothing orders requests across hardware queues, so a barrier freezes the
+ * whole queue: new submitters wait, everything already holding a tag is
+ * dispatched and completed, then the barrier runs on its own.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "blk.h"
+
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;
+	unsigned int		last_tag;
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Returns with preemption disabled, the caller must put_cpu() when it is
+ * done with the software queue.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return per_cpu_ptr(q->queue_ctx, get_cpu());
+}
+
+static struct blk_mq_hw_ctx *blk_mq_ctx_to_hctx(struct blk_mq_ctx *ctx)
+{
+	return ctx->queue->queue_hw_ctx[ctx->index_hw];
+}
+
+/*
+ * Start looking where this CPU found a tag last time, so that CPUs
+ * sharing a hardware queue don't all fight over the first word of the map.
+ */
+static int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx)
+{
+	unsigned int depth = hctx->queue_depth;
+	unsigned int tag;
+
+	tag = ctx->last_tag;
+	if (tag >= depth)
+		tag = 0;
+
+	tag = find_next_zero_bit(hctx->tag_map, depth, tag);
+	if (tag >= depth)
+		tag = find_first_zero_bit(hctx->tag_map, depth);
+
+	while (tag < depth) {
+		if (!test_and_set_bit_lock(tag, hctx->tag_map)) {
+			ctx->last_tag = tag + 1;
+			return tag;
+		}
+		tag = find_next_zero_bit(hctx->tag_map, depth, tag + 1);
+	}
+
+	return -1;
+}
+
+static void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	clear_bit_unlock(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->tag_wait))
+		wake_up(&hctx->tag_wait);
+}
+
+static bool blk_mq_tags_full(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_zero_bit(hctx->tag_map, hctx->queue_depth) >=
+		hctx->queue_depth;
+}
+
+static bool blk_mq_tags_idle(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_bit(hctx->tag_map, hctx->queue_depth) >=
+		hctx->queue_depth;
+}
+
+/*
+ * Get a free request. Might sleep waiting for a tag, but can not fail.
+ * Unless @frozen_ok is set, also waits for a barrier in progress to finish.
+ * Returns with preemption disabled and *ctxp set to the software queue of
+ * the CPU we ended up on.
+ */
+static struct request *blk_mq_alloc_request(struct request_queue *q,
+					    struct blk_mq_ctx **ctxp,
+					    bool frozen_ok)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = blk_mq_ctx_to_hctx(ctx);
+
+		tag = blk_mq_get_tag(hctx, ctx);
+		if (tag >= 0) {
+			/*
+			 * Pairs with the barrier in blk_mq_freeze_queue():
+			 * either the freezer sees our tag and waits for it,
+			 * or we see the queue frozen and back off.
+			 */
+			smp_mb();
+			if (likely(frozen_ok ||
+				   !test_bit(BLK_MQ_S_FROZEN, &hctx->state)))
+				break;
+
+			blk_mq_put_tag(hctx, tag);
+			put_cpu();
+
+			wait_event(hctx->tag_wait,
+				   !test_bit(BLK_MQ_S_FROZEN, &hctx->state));
+			continue;
+		}
+
+		put_cpu();
+
+		/*
+		 * Make sure what is already staged gets to the driver,
+		 * then wait for something to complete.
+		 */
+		blk_mq_run_hw_queue(hctx);
+
+		prepare_to_wait_exclusive(&hctx->tag_wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (blk_mq_tags_full(hctx))
+			io_schedule();
+		finish_wait(&hctx->tag_wait, &wait);
+	}
+
+	rq = &hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_hctx = hctx;
+
+	*ctxp = ctx;
+	return rq;
+}
+
+/**
+ * blk_mq_end_io - complete a request queued in multi-queue mode
+ * @rq:		the request
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *   Ends all the bios of @rq and gives its tag back. May be called from
+ *   interrupt context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_hctx;
+
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+	blk_mq_put_tag(hctx, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned long flags;
+	LIST_HEAD(rq_list);
+	unsigned int i;
+	int ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/*
+	 * Requests the driver bounced last time go first, then whatever
+	 * the CPUs mapped to us have staged since.
+	 */
+	spin_lock_irqsave(&hctx->lock, flags);
+	list_splice_init(&hctx->dispatch, &rq_list);
+	spin_unlock_irqrestore(&hctx->lock, flags);
+
+	for (i = 0; i < hctx->nr_ctx; i++) {
+		ctx = hctx->ctxs[i];
+		if (list_empty(&ctx->rq_list))
+			continue;
+
+		spin_lock_irqsave(&ctx->lock, flags);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irqrestore(&ctx->lock, flags);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_entry_rq(rq_list.next);
+		list_del_init(&rq->queuelist);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK) {
+			hctx->dispatched++;
+			continue;
+		}
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		if (ret != BLK_MQ_RQ_QUEUE_ERROR)
+			printk(KERN_ERR "blk-mq: bad return %d on queue_rq\n",
+			       ret);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver is out of resources, it is expected to have stopped
+	 * the queue and to restart it when something completes.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock_irqsave(&hctx->lock, flags);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irqrestore(&hctx->lock, flags);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - feed staged requests to the driver
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *   Only one context dispatches to a hardware queue at a time. If somebody
+ *   else is already at it, we just flag that there is more work and leave
+ *   it to them, rather than spinning on a lock.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_PENDING, &hctx->state);
+	smp_mb__after_clear_bit();
+
+	while (!test_and_set_bit_lock(BLK_MQ_S_RUNNING, &hctx->state)) {
+		while (test_and_clear_bit(BLK_MQ_S_PENDING, &hctx->state))
+			__blk_mq_run_hw_queue(hctx);
+
+		clear_bit_unlock(BLK_MQ_S_RUNNING, &hctx->state);
+		smp_mb__after_clear_bit();
+
+		/* somebody queued after our last pass but saw us running */
+		if (!test_bit(BLK_MQ_S_PENDING, &hctx->state))
+			break;
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	blk_mq_run_hw_queue(hctx);
+}
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart queues stopped by the driver
+ * @q:	the request queue
+ *
+ * Description:
+ *   Typically called from the completion interrupt once resources are
+ *   available again. The actual dispatch is punted to kblockd, since
+ *   ->queue_rq() must not be called with driver locks held or from
+ *   interrupt context.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		set_bit(BLK_MQ_S_PENDING, &hctx->state);
+		kblockd_schedule_work(q, &hctx->run_work);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/*
+ * Stop new requests from getting a tag on any hardware queue, then wait
+ * for every request that already has one to complete.
+ */
+static void blk_mq_freeze_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	mutex_lock(&q->mq_freeze_lock);
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		set_bit(BLK_MQ_S_FROZEN, &hctx->state);
+	smp_mb__after_clear_bit();
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		blk_mq_run_hw_queue(hctx);
+		wait_event(hctx->tag_wait, blk_mq_tags_idle(hctx));
+	}
+}
+
+static void blk_mq_unfreeze_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		clear_bit(BLK_MQ_S_FROZEN, &hctx->state);
+		wake_up_all(&hctx->tag_wait);
+	}
+
+	mutex_unlock(&q->mq_freeze_lock);
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool barrier = bio_rw_flagged(bio, BIO_RW_BARRIER);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned long flags;
+
+	/*
+	 * There is no flush sequencing in this mode. Barriers are only
+	 * passed on to drivers that said they can order them by tag,
+	 * and only once the queue is drained, since nothing orders the
+	 * hardware queues against each other.
+	 */
+	if (barrier && q->next_ordered != QUEUE_ORDERED_TAG) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(barrier))
+		blk_mq_freeze_queue(q);
+
+	rq = blk_mq_alloc_request(q, &ctx, barrier);
+	hctx = rq->mq_hctx;
+
+	init_request_from_bio(rq, bio);
+	rq->rq_disk = bio->bi_bdev->bd_disk;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+	drive_stat_acct(rq, 1);
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    bio_flagged(bio, BIO_CPU_AFFINE))
+		rq->cpu = ctx->cpu;
+
+	hctx->queued++;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+	put_cpu();
+
+	blk_mq_run_hw_queue(hctx);
+
+	/*
+	 * The barrier holds the only tag in use, so the hardware queue goes
+	 * idle when it completes. Only then may later requests be issued.
+	 */
+	if (unlikely(barrier)) {
+		wait_event(hctx->tag_wait, blk_mq_tags_idle(hctx));
+		blk_mq_unfreeze_queue(q);
+	}
+	return 0;
+}
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       void *driver_data,
+					       unsigned int i)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int depth = reg->queue_depth;
+	int node = reg->numa_node;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->tag_wait);
+	hctx->queue = q;
+	hctx->queue_num = i;
+	hctx->driver_data = driver_data;
+	hctx->queue_depth = depth;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(depth) * sizeof(long),
+				     GFP_KERNEL, node);
+	hctx->rqs = kzalloc_node(depth * sizeof(struct request), GFP_KERNEL,
+				 node);
+	if (!hctx->ctxs || !hctx->tag_map || !hctx->rqs) {
+		blk_mq_free_hctx(hctx);
+		return NULL;
+	}
+
+	return hctx;
+}
+
+/**
+ * blk_mq_init_queue - allocate a queue in multi-queue mode
+ * @reg:	driver ops and queue geometry
+ * @driver_data: stored in ->queuedata and in each hardware queue
+ *
+ * Description:
+ *   CPUs are spread over the hardware queues round robin. Each hardware
+ *   queue gets @reg->queue_depth tags. The queue is torn down with
+ *   blk_cleanup_queue() like any other.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+
+	if (!reg->ops || !reg->ops->queue_rq || !reg->nr_hw_queues ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	/* from here on blk_mq_free_queue() cleans up after us */
+	q->mq_ops = reg->ops;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = blk_mq_alloc_hctx(q, reg, driver_data, i);
+		if (!hctx)
+			goto err;
+		q->queue_hw_ctx[i] = hctx;
+		q->nr_hw_queues++;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i)) {
+			/* don't call ->exit_hctx() on what failed to init */
+			q->nr_hw_queues--;
+			q->queue_hw_ctx[i] = NULL;
+			blk_mq_free_hctx(hctx);
+			goto err;
+		}
+	}
+
+	for_each_possible_cpu(i) {
+		ctx = per_cpu_ptr(q->queue_ctx, i);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+		ctx->index_hw = q->mq_map[i] = i % reg->nr_hw_queues;
+
+		hctx = q->queue_hw_ctx[ctx->index_hw];
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	mutex_init(&q->mq_freeze_lock);
+	q->queuedata = driver_data;
+	blk_queue_make_request(q, blk_mq_make_request);
+	return q;
+
+err:
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called on the final put of the queue, after blk_sync_queue().
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; q->queue_hw_ctx && i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+
+		cancel_work_sync(&hctx->run_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+
+		blk_mq_free_hctx(hctx);
+	}
+
+	kfree(q->mq_map);
+	kfree(q->queue_hw_ctx);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+
+	q->mq_map = NULL;
+	q->queue_hw_ctx = NULL;
+	q->queue_ctx = NULL;
+	q->nr_hw_queues = 0;
+}
@@ -6,6 +6,7 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/blktrace_api.h>
+#include <linux/blk-mq.h>
 
 #include "blk.h"
 
@@ -408,6 +409,11 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+#ifdef CONFIG_BLK_MQ
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+#endif
+
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
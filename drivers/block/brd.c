@@ -13,6 +13,7 @@
 #include <linux/moduleparam.h>
 #include <linux/major.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/gfp.h>
@@ -255,6 +256,29 @@ static void copy_from_brd(void *dst, struct brd_device *brd,
 	}
 }
 
+/*
+ * Zero n bytes of the brd starting at sector. Pages are kept rather than
+ * freed: allocating them again on the next write could deadlock writeback
+ * under memory pressure. Does not sleep.
+ */
+static void discard_from_brd(struct brd_device *brd,
+			sector_t sector, size_t n)
+{
+	struct page *page;
+	unsigned int offset;
+	size_t len;
+
+	while (n) {
+		offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
+		len = min_t(size_t, n, PAGE_SIZE - offset);
+		page = brd_lookup_page(brd, sector);
+		if (page)
+			zero_user(page, offset, len);
+		sector += len >> SECTOR_SHIFT;
+		n -= len;
+	}
+}
+
 /*
  * Process a single bvec of a bio.
  */
@@ -300,6 +324,12 @@ static int brd_make_request(struct request_queue *q, struct bio *bio)
 						get_capacity(bdev->bd_disk))
 		goto out;
 
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_DISCARD))) {
+		err = 0;
+		discard_from_brd(brd, sector, bio->bi_size);
+		goto out;
+	}
+
 	rw = bio_rw(bio);
 	if (rw == READA)
 		rw = READ;
@@ -319,6 +349,48 @@ out:
 	return 0;
 }
 
+#ifdef CONFIG_BLK_MQ
+static int brd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct brd_device *brd = hctx->driver_data;
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	sector_t sector;
+	int rw;
+	int err = -EIO;
+
+	sector = blk_rq_pos(rq);
+	if (sector + blk_rq_sectors(rq) > get_capacity(brd->brd_disk))
+		goto out;
+
+	if (unlikely(blk_discard_rq(rq))) {
+		err = 0;
+		discard_from_brd(brd, sector, blk_rq_bytes(rq));
+		goto out;
+	}
+
+	rw = rq_data_dir(rq);
+	err = 0;
+	rq_for_each_segment(bvec, rq, iter) {
+		unsigned int len = bvec->bv_len;
+		err = brd_do_bvec(brd, bvec->bv_page, len,
+					bvec->bv_offset, rw, sector);
+		if (err)
+			break;
+		sector += len >> SECTOR_SHIFT;
+	}
+
+out:
+	blk_mq_end_io(rq, err);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops brd_mq_ops = {
+	.queue_rq	= brd_queue_rq,
+};
+#endif
+
 #ifdef CONFIG_BLK_DEV_XIP
 static int brd_direct_access (struct block_device *bdev, sector_t sector,
 			void **kaddr, unsigned long *pfn)
@@ -396,6 +468,11 @@ module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+#ifdef CONFIG_BLK_MQ
+static int use_mq;
+module_param(use_mq, int, 0);
+MODULE_PARM_DESC(use_mq, "Use multi-queue submission (one queue per CPU)");
+#endif
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -429,13 +506,35 @@ static struct brd_device *brd_alloc(int i)
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
-	if (!brd->brd_queue)
-		goto out_free_dev;
-	blk_queue_make_request(brd->brd_queue, brd_make_request);
+#ifdef CONFIG_BLK_MQ
+	if (use_mq) {
+		struct blk_mq_reg reg = {
+			.ops		= &brd_mq_ops,
+			.nr_hw_queues	= nr_cpu_ids,
+			.queue_depth	= 64,
+			.numa_node	= -1,
+		};
+
+		/*
+		 * Requests are served synchronously from ->queue_rq(), so
+		 * give every CPU its own hardware queue to dispatch from.
+		 */
+		brd->brd_queue = blk_mq_init_queue(&reg, brd);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+	} else
+#endif
+	{
+		brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+		blk_queue_make_request(brd->brd_queue, brd_make_request);
+	}
 	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
 	blk_queue_max_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
+	blk_queue_max_discard_sectors(brd->brd_queue, UINT_MAX);
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, brd->brd_queue);
 
 	disk = brd->brd_disk = alloc_disk(1 << part_shift);
 	if (!disk)
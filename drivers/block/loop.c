@@ -74,6 +74,7 @@
 #include <linux/gfp.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/mempool.h>
 
 #include <asm/uaccess.h>
 
@@ -82,6 +83,7 @@ static DEFINE_MUTEX(loop_devices_mutex);
 
 static int max_part;
 static int part_shift;
+static int direct_io;
 
 /*
  * Transfer functions
@@ -505,6 +507,169 @@ out:
 	return ret;
 }
 
+/*
+ * Direct I/O mode: the blocks of the backing file are looked up once with
+ * bmap() and bios are remapped straight onto the device holding the
+ * filesystem, the way swapfiles work. Nothing goes through the page cache
+ * of the backing file or through loop_thread, and as many bios can be in
+ * flight as the lower device will take.
+ */
+struct loop_extent {
+	sector_t	start;		/* first sector on the loop device */
+	sector_t	len;		/* in sectors */
+	sector_t	disk;		/* first sector on lo_direct_bdev */
+};
+
+#define LOOP_MAX_EXTENTS	(1 << 16)
+
+/*
+ * A remapped bio keeps the extent map and the pinned backing file in use
+ * until it completes: it holds a reference on lo_pending, which is hooked
+ * into its completion through one of these.
+ */
+struct loop_direct_io {
+	struct loop_device	*lo;
+	bio_end_io_t		*end_io;
+	void			*private;
+};
+
+#define LOOP_DIRECT_IO_POOL	16
+
+static mempool_t *loop_direct_io_pool;
+
+static void loop_put_pending(struct loop_device *lo)
+{
+	if (atomic_dec_and_test(&lo->lo_pending))
+		wake_up(&lo->lo_event);
+}
+
+static void loop_direct_end_io(struct bio *bio, int error)
+{
+	struct loop_direct_io *dio = bio->bi_private;
+	struct loop_device *lo = dio->lo;
+
+	bio->bi_end_io = dio->end_io;
+	bio->bi_private = dio->private;
+	mempool_free(dio, loop_direct_io_pool);
+
+	bio_endio(bio, error);
+	loop_put_pending(lo);
+}
+
+static void loop_direct_remap(struct loop_device *lo, struct bio *bio)
+{
+	struct loop_direct_io *dio;
+
+	dio = mempool_alloc(loop_direct_io_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->end_io = bio->bi_end_io;
+	dio->private = bio->bi_private;
+	bio->bi_end_io = loop_direct_end_io;
+	bio->bi_private = dio;
+	bio->bi_bdev = lo->lo_direct_bdev;
+}
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int l = 0, r = lo->lo_nr_extents;
+
+	while (l < r) {
+		unsigned int mid = (l + r) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (sector < ext->start)
+			r = mid;
+		else if (sector >= ext->start + ext->len)
+			l = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+/*
+ * Returns 1 if the bio was remapped and has to be resubmitted, 0 if it has
+ * been dealt with here.  The caller holds a reference on lo_pending, which
+ * goes with the bio if it is remapped and is dropped here otherwise.
+ */
+static int loop_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	struct loop_extent *ext;
+	struct bio_pair *bp;
+	sector_t left;
+
+	/* an empty barrier just needs to reach the backing device */
+	if (!bio_sectors(bio)) {
+		loop_direct_remap(lo, bio);
+		return 1;
+	}
+
+	ext = loop_find_extent(lo, bio->bi_sector);
+	if (unlikely(!ext)) {
+		bio_io_error(bio);
+		goto out;
+	}
+
+	left = ext->start + ext->len - bio->bi_sector;
+	if (likely(bio_sectors(bio) <= left)) {
+		bio->bi_sector = ext->disk + (bio->bi_sector - ext->start);
+		loop_direct_remap(lo, bio);
+		return 1;
+	}
+
+	/* loop_merge_bvec() only lets single page bios straddle extents */
+	if (WARN_ON_ONCE(bio->bi_vcnt != 1 || bio->bi_idx != 0)) {
+		bio_io_error(bio);
+		goto out;
+	}
+
+	/* both halves come back through loop_make_request() */
+	bp = bio_split(bio, left);
+	generic_make_request(&bp->bio1);
+	generic_make_request(&bp->bio2);
+	bio_pair_release(bp);
+out:
+	loop_put_pending(lo);
+	return 0;
+}
+
+static int loop_merge_bvec(struct request_queue *q, struct bvec_merge_data *bvm,
+			   struct bio_vec *biovec)
+{
+	struct loop_device *lo = q->queuedata;
+	sector_t sector = bvm->bi_sector + get_start_sect(bvm->bi_bdev);
+	unsigned int bio_sectors = bvm->bi_size >> 9;
+	struct loop_extent *ext;
+	sector_t left;
+	unsigned long flags;
+	int ret = biovec->bv_len;
+
+	/* loop_clr_fd() frees the extent map once the device is unbound */
+	spin_lock_irqsave(&lo->lo_lock, flags);
+	if (lo->lo_state != Lo_bound || !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		goto out;
+
+	ext = loop_find_extent(lo, sector);
+	if (!ext)
+		goto out;
+
+	left = ext->start + ext->len - sector;
+	if (left <= bio_sectors) {
+		/* the first page always has to be accepted */
+		if (bio_sectors)
+			ret = 0;
+		goto out;
+	}
+
+	left -= bio_sectors;
+	if (left < (biovec->bv_len >> 9))
+		ret = left << 9;
+out:
+	spin_unlock_irqrestore(&lo->lo_lock, flags);
+	return ret;
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -536,6 +701,13 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	/* switch requests (no bdev) still go through loop_thread */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) && old_bio->bi_bdev) {
+		/* loop_clr_fd() waits for this before freeing the extents */
+		atomic_inc(&lo->lo_pending);
+		spin_unlock_irq(&lo->lo_lock);
+		return loop_direct_bio(lo, old_bio);
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -560,6 +732,8 @@ static void loop_unplug(struct request_queue *q)
 
 struct switch_request {
 	struct file *file;
+	int direct_io;
+	int error;
 	struct completion wait;
 };
 
@@ -570,6 +744,11 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		/* queued behind the switch to direct I/O */
+		atomic_inc(&lo->lo_pending);
+		if (loop_direct_bio(lo, bio))
+			generic_make_request(bio);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
@@ -614,6 +793,24 @@ static int loop_thread(void *data)
 	return 0;
 }
 
+/*
+ * Send a magic BIO down the pipe, loop_thread does the switch once it has
+ * handled every bio queued before it.
+ */
+static int __loop_switch(struct loop_device *lo, struct switch_request *w)
+{
+	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
+	if (!bio)
+		return -ENOMEM;
+	init_completion(&w->wait);
+	w->error = 0;
+	bio->bi_private = w;
+	bio->bi_bdev = NULL;
+	loop_make_request(lo->lo_queue, bio);
+	wait_for_completion(&w->wait);
+	return w->error;
+}
+
 /*
  * loop_switch performs the hard work of switching a backing store.
  * First it needs to flush existing IO, it does this by sending a magic
@@ -622,16 +819,23 @@ static int loop_thread(void *data)
 static int loop_switch(struct loop_device *lo, struct file *file)
 {
 	struct switch_request w;
-	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
-	if (!bio)
-		return -ENOMEM;
-	init_completion(&w.wait);
+
 	w.file = file;
-	bio->bi_private = &w;
-	bio->bi_bdev = NULL;
-	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
-	return 0;
+	w.direct_io = 0;
+	return __loop_switch(lo, &w);
+}
+
+/*
+ * Switch to direct I/O between two bios: all that was queued before goes
+ * through the page cache, everything after around it.
+ */
+static int loop_switch_direct(struct loop_device *lo)
+{
+	struct switch_request w;
+
+	w.file = NULL;
+	w.direct_io = 1;
+	return __loop_switch(lo, &w);
 }
 
 /*
@@ -655,6 +859,20 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	/*
+	 * Nobody else goes through the page cache of the file while we are
+	 * here, drop it before bios start bypassing it.
+	 */
+	if (p->direct_io) {
+		p->error = invalidate_inode_pages2(old_file->f_mapping);
+		if (!p->error) {
+			spin_lock_irq(&lo->lo_lock);
+			lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+			spin_unlock_irq(&lo->lo_lock);
+		}
+		goto out;
+	}
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -671,6 +889,157 @@ out:
 }
 
 
+/*
+ * Build the extent map for direct I/O mode. The whole device has to be
+ * backed by allocated blocks, since writes to holes would need the
+ * filesystem, and the offset has to be block aligned.
+ */
+static int loop_build_extents(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	unsigned int shift = inode->i_blkbits - 9;
+	sector_t nr_sectors = get_capacity(lo->lo_disk);
+	sector_t first, block, last, phys;
+	struct loop_extent *ext = NULL, *tmp;
+	unsigned int nr = 0, max = 0;
+	int err;
+
+	if (!nr_sectors || (lo->lo_offset & ((1 << inode->i_blkbits) - 1)))
+		return -EINVAL;
+
+	first = lo->lo_offset >> inode->i_blkbits;
+	last = first + ((nr_sectors + (1 << shift) - 1) >> shift);
+
+	for (block = first; block < last; block++) {
+		phys = bmap(inode, block);
+		if (!phys) {
+			err = -ENXIO;
+			goto fail;
+		}
+
+		if (nr && ext[nr - 1].disk + ext[nr - 1].len == phys << shift) {
+			ext[nr - 1].len += 1 << shift;
+			continue;
+		}
+
+		if (nr == max) {
+			err = -E2BIG;
+			if (max == LOOP_MAX_EXTENTS)
+				goto fail;
+			max = max ? max * 2 : 16;
+			err = -ENOMEM;
+			tmp = krealloc(ext, max * sizeof(*ext), GFP_KERNEL);
+			if (!tmp)
+				goto fail;
+			ext = tmp;
+		}
+
+		ext[nr].start = (block - first) << shift;
+		ext[nr].len = 1 << shift;
+		ext[nr].disk = phys << shift;
+		nr++;
+
+		cond_resched();
+	}
+
+	lo->lo_extents = ext;
+	lo->lo_nr_extents = nr;
+	return 0;
+
+fail:
+	kfree(ext);
+	return err;
+}
+
+static void loop_unpin_file(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+	allow_write_access(file);
+}
+
+/*
+ * Pin the blocks of the backing file the way swapon does: while S_SWAPFILE
+ * is set the file can't be truncated, and with write access denied nobody
+ * can write to it and leave the blocks behind its page cache stale.
+ */
+static int loop_pin_file(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	int err;
+
+	err = deny_write_access(file);
+	if (err)
+		return err;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode))
+		err = -EBUSY;
+	else
+		inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	if (err)
+		allow_write_access(file);
+	return err;
+}
+
+static int loop_enable_direct_io(struct loop_device *lo)
+{
+	struct file *file = lo->lo_backing_file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	struct request_queue *q;
+	char b[BDEVNAME_SIZE];
+	int err;
+
+	/* writes through us would go around the page cache of the file */
+	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY) || lo->lo_encryption ||
+	    !S_ISREG(inode->i_mode) || !bdev || !mapping->a_ops->bmap)
+		return -EINVAL;
+
+	err = loop_pin_file(file);
+	if (err)
+		return err;
+
+	/* earlier writers may have left dirty pages behind */
+	err = filemap_write_and_wait(mapping);
+	if (!err)
+		err = loop_build_extents(lo);
+	if (err)
+		goto out_unpin;
+
+	q = bdev_get_queue(bdev);
+	blk_queue_stack_limits(lo->lo_queue, q);
+	if (q->merge_bvec_fn)
+		blk_queue_max_sectors(lo->lo_queue, PAGE_SIZE >> 9);
+	blk_queue_merge_bvec(lo->lo_queue, loop_merge_bvec);
+	lo->lo_direct_bdev = bdev;
+
+	err = loop_switch_direct(lo);
+	if (err)
+		goto out_free;
+
+	printk(KERN_INFO "loop%d: direct I/O to %s, %u extents\n",
+	       lo->lo_number, bdevname(bdev, b),
+	       lo->lo_nr_extents);
+	return 0;
+
+out_free:
+	blk_queue_merge_bvec(lo->lo_queue, NULL);
+	kfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_direct_bdev = NULL;
+out_unpin:
+	loop_unpin_file(file);
+	return err;
+}
+
 /*
  * loop_change_fd switched the backing store of a loopback device to
  * a new file. This is useful for operating system installers to free up
@@ -695,6 +1064,11 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* and the block map belongs to the old file */
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -843,6 +1217,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 		error = PTR_ERR(lo->lo_thread);
 		goto out_clr;
 	}
+	atomic_set(&lo->lo_pending, 1);
 	lo->lo_state = Lo_bound;
 	wake_up_process(lo->lo_thread);
 	if (max_part > 0)
@@ -924,6 +1299,22 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	/*
+	 * No more bios get remapped now, wait for those that were before
+	 * the extent map goes and the file is unpinned.
+	 */
+	loop_put_pending(lo);
+	wait_event(lo->lo_event, !atomic_read(&lo->lo_pending));
+
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		blk_queue_merge_bvec(lo->lo_queue, NULL);
+		loop_unpin_file(filp);
+	}
+	kfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_direct_bdev = NULL;
+
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
 
@@ -978,6 +1369,13 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
 
+	/* the block map is fixed for as long as direct I/O is on */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type ||
+	     lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		return -EBUSY;
+
 	err = loop_release_xfer(lo);
 	if (err)
 		return err;
@@ -1028,6 +1426,17 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		lo->lo_key_owner = uid;
 	}	
 
+	/*
+	 * Direct I/O stays on until LOOP_CLR_FD. The module default only
+	 * applies where it can, an explicit request reports why it can't.
+	 */
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    ((info->lo_flags & LO_FLAGS_DIRECT_IO) || direct_io)) {
+		err = loop_enable_direct_io(lo);
+		if (err && (info->lo_flags & LO_FLAGS_DIRECT_IO))
+			return err;
+	}
+
 	return 0;
 }
 
@@ -1179,6 +1588,9 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	err = -ENXIO;
 	if (unlikely(lo->lo_state != Lo_bound))
 		goto out;
+	err = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
 	err = figure_loop_size(lo);
 	if (unlikely(err))
 		goto out;
@@ -1456,6 +1868,8 @@ module_param(max_loop, int, 0);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(direct_io, bool, 0644);
+MODULE_PARM_DESC(direct_io, "Bypass the page cache of backing files where possible");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1614,8 +2028,15 @@ static int __init loop_init(void)
 		range = 1UL << (MINORBITS - part_shift);
 	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
+	loop_direct_io_pool = mempool_create_kmalloc_pool(LOOP_DIRECT_IO_POOL,
+					sizeof(struct loop_direct_io));
+	if (!loop_direct_io_pool)
+		return -ENOMEM;
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		mempool_destroy(loop_direct_io_pool);
 		return -EIO;
+	}
 
 	for (i = 0; i < nr; i++) {
 		lo = loop_alloc(i);
@@ -1642,6 +2063,7 @@ Enomem:
 		loop_free(lo);
 
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_direct_io_pool);
 	return -ENOMEM;
 }
 
@@ -1657,6 +2079,7 @@ static void __exit loop_exit(void)
 
 	blk_unregister_region(MKDEV(LOOP_MAJOR, 0), range);
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_direct_io_pool);
 }
 
 module_init(loop_init);
@@ -1,6 +1,7 @@
 //#define DEBUG
 #include <linux/spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -10,6 +11,13 @@
 
 static int major, index;
 
+#ifdef CONFIG_BLK_MQ
+static int use_mq;
+module_param(use_mq, int, 0);
+MODULE_PARM_DESC(use_mq, "Use multi-queue submission "
+		 "(no SCSI passthrough, barriers only if the host tags them)");
+#endif
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -70,12 +78,22 @@ static void blk_done(struct virtqueue *vq)
 			vbr->req->errors = vbr->in_hdr.errors;
 		}
 
-		__blk_end_request_all(vbr->req, error);
+#ifdef CONFIG_BLK_MQ
+		if (vblk->disk->queue->mq_ops)
+			blk_mq_end_io(vbr->req, error);
+		else
+#endif
+			__blk_end_request_all(vbr->req, error);
 		list_del(&vbr->list);
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+#ifdef CONFIG_BLK_MQ
+	if (vblk->disk->queue->mq_ops)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue);
+	else
+#endif
+		blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
@@ -182,6 +200,33 @@ static void do_virtblk_request(struct request_queue *q)
 		vblk->vq->vq_ops->kick(vblk->vq);
 }
 
+#ifdef CONFIG_BLK_MQ
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
+{
+	struct virtio_blk *vblk = hctx->driver_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+
+	/* If this request fails, stop queue and wait for something to
+	   finish to restart it. */
+	if (!do_req(hctx->queue, vblk, req)) {
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+
+	vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+};
+#endif
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -200,6 +245,12 @@ static int virtblk_ioctl(struct block_device *bdev, fmode_t mode,
 	if (!virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_SCSI))
 		return -ENOTTY;
 
+#ifdef CONFIG_BLK_MQ
+	/* packet commands go through the request_list we don't have */
+	if (disk->queue->mq_ops)
+		return -ENOTTY;
+#endif
+
 	return scsi_cmd_ioctl(disk->queue, disk, mode, cmd,
 			      (void __user *)data);
 }
@@ -293,10 +344,29 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
-	if (!vblk->disk->queue) {
-		err = -ENOMEM;
-		goto out_put_disk;
+#ifdef CONFIG_BLK_MQ
+	if (use_mq) {
+		struct blk_mq_reg reg = {
+			.ops		= &virtblk_mq_ops,
+			.nr_hw_queues	= 1,	/* a single virtqueue */
+			.queue_depth	= 128,
+			.numa_node	= -1,
+		};
+
+		vblk->disk->queue = blk_mq_init_queue(&reg, vblk);
+		if (!vblk->disk->queue) {
+			err = -ENOMEM;
+			goto out_put_disk;
+		}
+	} else
+#endif
+	{
+		vblk->disk->queue = blk_init_queue(do_virtblk_request,
+						   &vblk->lock);
+		if (!vblk->disk->queue) {
+			err = -ENOMEM;
+			goto out_put_disk;
+		}
 	}
 
 	vblk->disk->queue->queuedata = vblk;
@@ -322,6 +392,14 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	index++;
 
 	/* If barriers are supported, tell block layer that queue is ordered */
+#ifdef CONFIG_BLK_MQ
+	if (vblk->disk->queue->mq_ops) {
+		/* multi-queue mode can't sequence flushes, only tags */
+		if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
+			blk_queue_ordered(vblk->disk->queue,
+					  QUEUE_ORDERED_TAG, NULL);
+	} else
+#endif
 	if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
 		blk_queue_ordered(vblk->disk->queue, QUEUE_ORDERED_DRAIN_FLUSH,
 				  virtblk_prepare_flush);
@@ -449,6 +449,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 
 	struct cpufreq_policy *policy;
 	unsigned int j;
+	int packed = 0;
 
 	this_dbs_info->freq_lo = 0;
 	policy = this_dbs_info->cur_policy;
@@ -463,6 +464,9 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	 * Any frequency increase takes it to the maximum frequency.
 	 * Frequency reduction happens at minimum steps of
 	 * 5% (default) of current frequency
+	 *
+	 * CPUs the scheduler packs small tasks on are the exception, see
+	 * sched_packing_util(): their frequency follows the packed load.
 	 */
 
 	/* Get Absolute Load - in terms of freq */
@@ -473,7 +477,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 		cputime64_t cur_wall_time, cur_idle_time;
 		unsigned int idle_time, wall_time;
 		unsigned int load, load_freq;
-		int freq_avg;
+		int freq_avg, packed_util;
 
 		j_dbs_info = &per_cpu(od_cpu_dbs_info, j);
 
@@ -509,26 +513,49 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 
 		load = 100 * (wall_time - idle_time) / wall_time;
 
+		/*
+		 * Periodic small tasks packed on this cpu may all have slept
+		 * through the sample: size for their longer term load.
+		 */
+		packed_util = sched_packing_util(j);
+		if (packed_util >= 0)
+			load = max_t(unsigned int, load, packed_util);
+
 		freq_avg = __cpufreq_driver_getavg(policy, j);
 		if (freq_avg <= 0)
 			freq_avg = policy->cur;
 
 		load_freq = load * freq_avg;
-		if (load_freq > max_load_freq)
+		if (load_freq > max_load_freq) {
 			max_load_freq = load_freq;
+			packed = packed_util >= 0;
+		}
 	}
 
 	/* Check for frequency increase */
 	if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
+		unsigned int freq_next = policy->max;
+
+		/*
+		 * The scheduler spreads the packed tasks again before they
+		 * saturate the cpu, so when the busiest cpu is a packed one
+		 * it only needs to step up as far as its load requires.
+		 */
+		if (packed)
+			freq_next = max_load_freq /
+				(dbs_tuners_ins.up_threshold -
+				 dbs_tuners_ins.down_differential);
+
 		/* if we are already at full speed then break out early */
 		if (!dbs_tuners_ins.powersave_bias) {
 			if (policy->cur == policy->max)
 				return;
 
-			__cpufreq_driver_target(policy, policy->max,
-				CPUFREQ_RELATION_H);
+			__cpufreq_driver_target(policy, freq_next,
+				packed ? CPUFREQ_RELATION_L :
+					 CPUFREQ_RELATION_H);
 		} else {
-			int freq = powersave_bias_target(policy, policy->max,
+			int freq = powersave_bias_target(policy, freq_next,
 					CPUFREQ_RELATION_H);
 			__cpufreq_driver_target(policy, freq,
 				CPUFREQ_RELATION_L);
@@ -17,6 +17,9 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/interrupt.h>
+#include <linux/rbtree.h>
 #include <linux/backing-dev.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
@@ -41,6 +44,7 @@ struct convert_context {
 	unsigned int idx_out;
 	sector_t sector;
 	atomic_t pending;
+	struct ablkcipher_request *req;
 };
 
 /*
@@ -50,6 +54,8 @@ struct dm_crypt_io {
 	struct dm_target *target;
 	struct bio *base_bio;
 	struct work_struct work;
+	struct list_head list;		/* inline read decryption */
+	struct rb_node rb_node;		/* sorted write submission */
 
 	struct convert_context ctx;
 
@@ -79,7 +85,8 @@ struct crypt_iv_operations {
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
  */
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_SUBMIT_FROM_CRYPT_CPUS, DM_CRYPT_NO_READ_WORKQUEUE };
 struct crypt_config {
 	struct dm_dev *dev;
 	sector_t start;
@@ -96,6 +103,20 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/*
+	 * Encrypted writes finish on whichever CPU did the work, so they
+	 * are parked in a tree sorted by sector and sent down in order
+	 * by dmcrypt_write. The tree is protected by the waitqueue lock.
+	 */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_thread_wait;
+	struct rb_root write_tree;
+
+	/* reads waiting to be decrypted in softirq context */
+	spinlock_t read_lock;
+	struct list_head read_list;
+	struct tasklet_struct read_tasklet;
+
 	/*
 	 * crypto related data
 	 */
@@ -122,7 +143,6 @@ struct crypt_config {
 	 * correctly aligned.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -140,6 +160,7 @@ static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
+static void kcryptd_crypt_read_inline(struct dm_crypt_io *io);
 
 /*
  * Different IV generation algorithms:
@@ -333,6 +354,7 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
 	ctx->sector = sector + cc->iv_offset;
+	ctx->req = NULL;
 	init_completion(&ctx->restart);
 }
 
@@ -402,16 +424,34 @@ static int crypt_convert_block(struct crypt_config *cc,
 
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
+
+/*
+ * The request is kept in the conversion context rather than in
+ * crypt_config so that several CPUs can convert at the same time.
+ * Callers in softirq context must have allocated ctx->req already.
+ */
 static void crypt_alloc_req(struct crypt_config *cc,
 			    struct convert_context *ctx)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
-					CRYPTO_TFM_REQ_MAY_SLEEP,
-					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+	u32 flags = CRYPTO_TFM_REQ_MAY_BACKLOG;
+
+	if (!in_interrupt())
+		flags |= CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	if (!ctx->req)
+		ctx->req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(ctx->req, cc->tfm);
+	ablkcipher_request_set_callback(ctx->req, flags, kcryptd_async_done,
+					dmreq_of_req(cc, ctx->req));
+}
+
+static void crypt_free_req(struct crypt_config *cc,
+			   struct convert_context *ctx)
+{
+	if (ctx->req) {
+		mempool_free(ctx->req, cc->req_pool);
+		ctx->req = NULL;
+	}
 }
 
 /*
@@ -431,7 +471,7 @@ static int crypt_convert(struct crypt_config *cc,
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, ctx->req);
 
 		switch (r) {
 		/* async */
@@ -440,7 +480,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			ctx->req = NULL;
 			ctx->sector++;
 			continue;
 
@@ -448,16 +488,20 @@ static int crypt_convert(struct crypt_config *cc,
 		case 0:
 			atomic_dec(&ctx->pending);
 			ctx->sector++;
-			cond_resched();
+			if (!in_interrupt())
+				cond_resched();
 			continue;
 
 		/* error */
 		default:
 			atomic_dec(&ctx->pending);
+			crypt_free_req(cc, ctx);
 			return r;
 		}
 	}
 
+	crypt_free_req(cc, ctx);
+
 	return 0;
 }
 
@@ -592,13 +636,21 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
  * Needed because it would be very unwise to do decryption in an
  * interrupt context.
  *
- * kcryptd performs the actual encryption or decryption.
+ * kcryptd performs the actual encryption or decryption. It runs a
+ * thread per CPU, so bios from different CPUs are converted in parallel.
+ *
+ * kcryptd_io performs the IO submission that cannot be done directly:
+ * reads that could not get a clone without blocking and, with
+ * submit_from_crypt_cpus, writes finished by an asynchronous cipher.
  *
- * kcryptd_io performs the IO submission.
+ * dmcrypt_write submits the encrypted writes, sorted by sector.
  *
  * They must be separated as otherwise the final stages could be
  * starved by new requests which can block in the first stages due
  * to memory allocation.
+ *
+ * With no_read_workqueue (synchronous ciphers only) reads are decrypted
+ * in softirq context right after they complete, skipping kcryptd.
  */
 static void crypt_endio(struct bio *clone, int error)
 {
@@ -618,7 +670,10 @@ static void crypt_endio(struct bio *clone, int error)
 	bio_put(clone);
 
 	if (rw == READ && !error) {
-		kcryptd_queue_crypt(io);
+		if (test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags))
+			kcryptd_crypt_read_inline(io);
+		else
+			kcryptd_queue_crypt(io);
 		return;
 	}
 
@@ -639,25 +694,22 @@ static void clone_init(struct dm_crypt_io *io, struct bio *clone)
 	clone->bi_destructor = dm_crypt_bio_destructor;
 }
 
-static void kcryptd_io_read(struct dm_crypt_io *io)
+static int kcryptd_io_read(struct dm_crypt_io *io, gfp_t gfp)
 {
 	struct crypt_config *cc = io->target->private;
 	struct bio *base_bio = io->base_bio;
 	struct bio *clone;
 
-	crypt_inc_pending(io);
-
 	/*
 	 * The block layer might modify the bvec array, so always
 	 * copy the required bvecs because we need the original
 	 * one in order to decrypt the whole bio data *afterwards*.
 	 */
-	clone = bio_alloc_bioset(GFP_NOIO, bio_segments(base_bio), cc->bs);
-	if (unlikely(!clone)) {
-		io->error = -ENOMEM;
-		crypt_dec_pending(io);
-		return;
-	}
+	clone = bio_alloc_bioset(gfp, bio_segments(base_bio), cc->bs);
+	if (unlikely(!clone))
+		return 1;
+
+	crypt_inc_pending(io);
 
 	clone_init(io, clone);
 	clone->bi_idx = 0;
@@ -668,6 +720,7 @@ static void kcryptd_io_read(struct dm_crypt_io *io)
 	       sizeof(struct bio_vec) * clone->bi_vcnt);
 
 	generic_make_request(clone);
+	return 0;
 }
 
 static void kcryptd_io_write(struct dm_crypt_io *io)
@@ -680,9 +733,12 @@ static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_io_read(io);
-	else
+	if (bio_data_dir(io->base_bio) == READ) {
+		crypt_inc_pending(io);
+		if (kcryptd_io_read(io, GFP_NOIO))
+			io->error = -ENOMEM;
+		crypt_dec_pending(io);
+	} else
 		kcryptd_io_write(io);
 }
 
@@ -694,11 +750,64 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
+static struct dm_crypt_io *crypt_io_from_node(struct rb_node *node)
+{
+	return rb_entry(node, struct dm_crypt_io, rb_node);
+}
+
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct dm_crypt_io *io;
+	struct rb_root write_tree;
+	struct blk_plug plug;
+	DECLARE_WAITQUEUE(wait, current);
+
+	while (1) {
+		spin_lock_irq(&cc->write_thread_wait.lock);
+		while (RB_EMPTY_ROOT(&cc->write_tree)) {
+			__set_current_state(TASK_INTERRUPTIBLE);
+			__add_wait_queue(&cc->write_thread_wait, &wait);
+			spin_unlock_irq(&cc->write_thread_wait.lock);
+
+			if (unlikely(kthread_should_stop())) {
+				set_current_state(TASK_RUNNING);
+				remove_wait_queue(&cc->write_thread_wait, &wait);
+				return 0;
+			}
+
+			schedule();
+
+			set_current_state(TASK_RUNNING);
+			spin_lock_irq(&cc->write_thread_wait.lock);
+			__remove_wait_queue(&cc->write_thread_wait, &wait);
+		}
+
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_thread_wait.lock);
+
+		/*
+		 * The io can be freed as soon as its clone is submitted,
+		 * so take it out of the tree first instead of using rb_next.
+		 */
+		blk_start_plug(&plug);
+		do {
+			io = crypt_io_from_node(rb_first(&write_tree));
+			rb_erase(&io->rb_node, &write_tree);
+			kcryptd_io_write(io);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+		blk_finish_plug(&plug);
+	}
+}
+
 static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 					  int error, int async)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
+	struct rb_node **rbp, *parent;
+	unsigned long flags;
 
 	if (unlikely(error < 0)) {
 		crypt_free_buffer_pages(cc, clone);
@@ -713,10 +822,33 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
-		kcryptd_queue_io(io);
-	else
-		generic_make_request(clone);
+	/*
+	 * A synchronously converted fragment that is not the last one
+	 * shares io->ctx with the next fragment, so it can't be parked.
+	 */
+	if (test_bit(DM_CRYPT_SUBMIT_FROM_CRYPT_CPUS, &cc->flags) ||
+	    (!async && io->ctx.idx_in < io->base_bio->bi_vcnt)) {
+		if (async)
+			kcryptd_queue_io(io);
+		else
+			generic_make_request(clone);
+		return;
+	}
+
+	spin_lock_irqsave(&cc->write_thread_wait.lock, flags);
+	rbp = &cc->write_tree.rb_node;
+	parent = NULL;
+	while (*rbp) {
+		parent = *rbp;
+		if (io->sector < crypt_io_from_node(parent)->sector)
+			rbp = &parent->rb_left;
+		else
+			rbp = &parent->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, rbp);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+	wake_up_locked(&cc->write_thread_wait);
+	spin_unlock_irqrestore(&cc->write_thread_wait.lock, flags);
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -768,7 +900,9 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			if (unlikely(r < 0))
 				break;
 
-			io->sector = sector;
+			/* the last fragment may already sit in the write tree */
+			if (remaining)
+				io->sector = sector;
 		}
 
 		/*
@@ -818,7 +952,8 @@ static void kcryptd_crypt_read_done(struct dm_crypt_io *io, int error)
 	crypt_dec_pending(io);
 }
 
-static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
+static void kcryptd_crypt_read_convert(struct dm_crypt_io *io,
+				       struct ablkcipher_request *req)
 {
 	struct crypt_config *cc = io->target->private;
 	int r = 0;
@@ -827,6 +962,7 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 
 	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
 			   io->sector);
+	io->ctx.req = req;
 
 	r = crypt_convert(cc, &io->ctx);
 
@@ -836,6 +972,53 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	crypt_dec_pending(io);
 }
 
+/*
+ * Decrypt a completed read without going through kcryptd. This runs
+ * in softirq context, bios completed from hard interrupts, with
+ * interrupts disabled or from process context are handed to a tasklet.
+ * The cipher is synchronous, so one request allocated up front carries
+ * the whole conversion and nothing in it can block.
+ */
+static void kcryptd_crypt_read_inline(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	struct ablkcipher_request *req;
+	unsigned long flags;
+
+	if (!in_interrupt() || in_irq() || irqs_disabled()) {
+		spin_lock_irqsave(&cc->read_lock, flags);
+		list_add_tail(&io->list, &cc->read_list);
+		spin_unlock_irqrestore(&cc->read_lock, flags);
+		tasklet_schedule(&cc->read_tasklet);
+		return;
+	}
+
+	req = mempool_alloc(cc->req_pool, GFP_ATOMIC);
+	if (unlikely(!req)) {
+		kcryptd_queue_crypt(io);
+		return;
+	}
+
+	kcryptd_crypt_read_convert(io, req);
+}
+
+static void kcryptd_crypt_read_tasklet(unsigned long data)
+{
+	struct crypt_config *cc = (struct crypt_config *)data;
+	struct dm_crypt_io *io;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&cc->read_lock);
+	list_splice_init(&cc->read_list, &list);
+	spin_unlock_irq(&cc->read_lock);
+
+	while (!list_empty(&list)) {
+		io = list_first_entry(&list, struct dm_crypt_io, list);
+		list_del(&io->list);
+		kcryptd_crypt_read_inline(io);
+	}
+}
+
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error)
 {
@@ -865,7 +1048,7 @@ static void kcryptd_crypt(struct work_struct *work)
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
 	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_crypt_read_convert(io);
+		kcryptd_crypt_read_convert(io, NULL);
 	else
 		kcryptd_crypt_write_convert(io);
 }
@@ -946,7 +1129,7 @@ static int crypt_wipe_key(struct crypt_config *cc)
 
 /*
  * Construct an encryption mapping:
- * <cipher> <key> <iv_offset> <dev_path> <start>
+ * <cipher> <key> <iv_offset> <dev_path> <start> [<#opt_params> <opt_params>]
  */
 static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -959,8 +1142,9 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char *ivopts;
 	unsigned int key_size;
 	unsigned long long tmpll;
+	unsigned int opt_params, i;
 
-	if (argc != 5) {
+	if (argc < 5) {
 		ti->error = "Not enough arguments";
 		return -EINVAL;
 	}
@@ -1071,7 +1255,6 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
 
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
@@ -1102,6 +1285,32 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 	cc->start = tmpll;
 
+	if (argc > 5) {
+		if (sscanf(argv[5], "%u", &opt_params) != 1 ||
+		    opt_params != argc - 6) {
+			ti->error = "Invalid number of feature arguments";
+			goto bad_device;
+		}
+
+		for (i = 6; i < argc; i++) {
+			if (!strcasecmp(argv[i], "submit_from_crypt_cpus"))
+				set_bit(DM_CRYPT_SUBMIT_FROM_CRYPT_CPUS,
+					&cc->flags);
+			else if (!strcasecmp(argv[i], "no_read_workqueue")) {
+				if (crypto_ablkcipher_tfm(tfm)->__crt_alg->cra_flags &
+				    CRYPTO_ALG_ASYNC)
+					DMWARN("Asynchronous cipher, "
+					       "ignoring no_read_workqueue");
+				else
+					set_bit(DM_CRYPT_NO_READ_WORKQUEUE,
+						&cc->flags);
+			} else {
+				ti->error = "Invalid feature arguments";
+				goto bad_device;
+			}
+		}
+	}
+
 	if (dm_get_device(ti, argv[3], cc->start, ti->len,
 			  dm_table_get_mode(ti->table), &cc->dev)) {
 		ti->error = "Device lookup failed";
@@ -1126,16 +1335,32 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		goto bad_crypt_queue;
 	}
 
+	spin_lock_init(&cc->read_lock);
+	INIT_LIST_HEAD(&cc->read_list);
+	tasklet_init(&cc->read_tasklet, kcryptd_crypt_read_tasklet,
+		     (unsigned long)cc);
+
+	init_waitqueue_head(&cc->write_thread_wait);
+	cc->write_tree = RB_ROOT;
+
+	cc->write_thread = kthread_run(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ti->error = "Couldn't spawn write thread";
+		goto bad_write_thread;
+	}
+
 	ti->num_flush_requests = 1;
 	ti->private = cc;
 	return 0;
 
+bad_write_thread:
+	destroy_workqueue(cc->crypt_queue);
 bad_crypt_queue:
 	destroy_workqueue(cc->io_queue);
 bad_io_queue:
@@ -1165,12 +1390,12 @@ static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
 
+	kthread_stop(cc->write_thread);
+	tasklet_kill(&cc->read_tasklet);
+
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
 
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
-
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
 	mempool_destroy(cc->req_pool);
@@ -1200,9 +1425,10 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 
 	io = crypt_io_alloc(ti, bio, bio->bi_sector - ti->begin);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_queue_io(io);
-	else
+	if (bio_data_dir(io->base_bio) == READ) {
+		if (kcryptd_io_read(io, GFP_NOWAIT))
+			kcryptd_queue_io(io);
+	} else
 		kcryptd_queue_crypt(io);
 
 	return DM_MAPIO_SUBMITTED;
@@ -1213,6 +1439,7 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
 	unsigned int sz = 0;
+	unsigned int opt_params;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
@@ -1240,6 +1467,18 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
+
+		opt_params = !!test_bit(DM_CRYPT_SUBMIT_FROM_CRYPT_CPUS,
+					&cc->flags) +
+			     !!test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags);
+		if (opt_params) {
+			DMEMIT(" %u", opt_params);
+			if (test_bit(DM_CRYPT_SUBMIT_FROM_CRYPT_CPUS,
+				     &cc->flags))
+				DMEMIT(" submit_from_crypt_cpus");
+			if (test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags))
+				DMEMIT(" no_read_workqueue");
+		}
 		break;
 	}
 	return 0;
@@ -1323,7 +1562,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 7, 0},
+	.version = {1, 8, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
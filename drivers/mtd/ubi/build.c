@@ -28,9 +28,9 @@
  * specified, UBI does not attach any MTD device, but it is possible to do
  * later using the "UBI control device".
  *
- * At the moment we only attach UBI devices by scanning, which will become a
- * bottleneck when flashes reach certain large size. Then one may improve UBI
- * and add other methods, although it does not seem to be easy to do.
+ * UBI devices are attached by scanning, which becomes a bottleneck when
+ * flashes reach certain large size. With %CONFIG_MTD_UBI_FASTMAP, a fastmap
+ * stored on the flash lets scanning skip most of the PEBs, see fastmap.c.
  */
 
 #include <linux/err.h>
@@ -45,6 +45,13 @@
 #include <linux/kernel.h>
 #include "ubi.h"
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/* Whether to attach using, and maintain, a fastmap */
+static int fastmap = 1;
+module_param(fastmap, bool, 0444);
+MODULE_PARM_DESC(fastmap, "Use the fastmap to attach UBI devices (default: 1)");
+#endif
+
 /* Maximum length of the 'mtd=' parameter */
 #define MTD_PARAM_LEN_MAX 64
 
@@ -568,10 +575,9 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, if there is a fastmap on the device, 'ubi_scan()' only scans the PEBs
+ * it does not describe. Full scanning is the fall-back if there is no usable
+ * fastmap.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
@@ -599,11 +605,20 @@ static int attach_by_scanning(struct ubi_device *ubi)
 	if (err)
 		goto out_wl;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	err = ubi_fastmap_init(ubi, si);
+	if (err)
+		goto out_wl;
+#endif
+
 	ubi_scan_destroy_si(si);
 	return 0;
 
 out_wl:
 	ubi_wl_close(ubi);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	ubi_fastmap_close(ubi);
+#endif
 out_vtbl:
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
@@ -829,13 +844,24 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
 	return 0;
 }
 
+/**
+ * stop_threads - stop the background threads of an UBI device.
+ * @ubi: UBI device description object
+ */
+static void stop_threads(struct ubi_device *ubi)
+{
+	ubi_wl_stop_erase_threads(ubi);
+	if (ubi->bgt_thread)
+		kthread_stop(ubi->bgt_thread);
+}
+
 /**
  * ubi_reboot_notifier - halt UBI transactions immediately prior to a reboot.
  * @n: reboot notifier object
  * @state: SYS_RESTART, SYS_HALT, or SYS_POWER_OFF
  * @cmd: pointer to command string for RESTART2
  *
- * This function stops the UBI background thread so that the flash device
+ * This function stops the UBI background threads so that the flash device
  * remains quiescent when Linux restarts the system. Any queued work will be
  * discarded, but this function will block until do_work() finishes if an
  * operation is already in progress.
@@ -851,8 +877,7 @@ static int ubi_reboot_notifier(struct notifier_block *n, unsigned long state,
 	struct ubi_device *ubi;
 
 	ubi = container_of(n, struct ubi_device, reboot_notifier);
-	if (ubi->bgt_thread)
-		kthread_stop(ubi->bgt_thread);
+	stop_threads(ubi);
 	ubi_sync(ubi->ubi_num);
 	return NOTIFY_DONE;
 }
@@ -940,6 +965,12 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	mutex_init(&ubi->fm_mutex);
+	init_rwsem(&ubi->fm_sem);
+	INIT_LIST_HEAD(&ubi->fm_held);
+	ubi->fm_disabled = !fastmap;
+#endif
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 
@@ -975,6 +1006,11 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 			goto out_detach;
 	}
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Failing to write the fastmap only costs the next attach a scan */
+	ubi_update_fastmap(ubi);
+#endif
+
 	err = uif_init(ubi);
 	if (err)
 		goto out_nofree;
@@ -987,6 +1023,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		goto out_uif;
 	}
 
+	ubi_wl_start_erase_threads(ubi);
+
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
 	ubi_msg("MTD device size:            %llu MiB", ubi->flash_size >> 20);
@@ -994,6 +1032,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi_msg("number of bad PEBs:         %d", ubi->bad_peb_count);
 	ubi_msg("max. allowed volumes:       %d", ubi->vtbl_slots);
 	ubi_msg("wear-leveling threshold:    %d", CONFIG_MTD_UBI_WL_THRESHOLD);
+	ubi_msg("erase pool/threads:         %d/%d", CONFIG_MTD_UBI_ERASE_POOL,
+		CONFIG_MTD_UBI_ERASE_WORKERS);
 	ubi_msg("number of internal volumes: %d", UBI_INT_VOL_COUNT);
 	ubi_msg("number of user volumes:     %d",
 		ubi->vol_count - UBI_INT_VOL_COUNT);
@@ -1012,6 +1052,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (!DBG_DISABLE_BGT)
 		ubi->thread_enabled = 1;
 	wake_up_process(ubi->bgt_thread);
+	ubi_wl_wake_erase_threads(ubi);
 	spin_unlock(&ubi->wl_lock);
 
 	/* Flash device priority is 0 - UBI needs to shut down first */
@@ -1029,6 +1070,9 @@ out_nofree:
 	do_free = 0;
 out_detach:
 	ubi_wl_close(ubi);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	ubi_fastmap_close(ubi);
+#endif
 	if (do_free)
 		free_user_volumes(ubi);
 	free_internal_volumes(ubi);
@@ -1091,8 +1135,12 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	 * prevent it from doing anything on this device while we are freeing.
 	 */
 	unregister_reboot_notifier(&ubi->reboot_notifier);
-	if (ubi->bgt_thread)
-		kthread_stop(ubi->bgt_thread);
+	stop_threads(ubi);
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Leave an up-to-date fastmap behind for the next attach */
+	ubi_update_fastmap(ubi);
+#endif
 
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
@@ -1102,6 +1150,9 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 
 	uif_close(ubi);
 	ubi_wl_close(ubi);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	ubi_fastmap_close(ubi);
+#endif
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
@@ -0,0 +1,949 @@
+/*
+ * Copyright (c) International Business Machines Corp., 2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap sub-system.
+ *
+ * Attaching a UBI device normally means reading the EC and VID headers of
+ * every PEB, which takes time proportional to the flash size. The fastmap is
+ * a snapshot of the scanning information - the free PEBs, the PEBs to erase
+ * and the LEB to PEB mapping of all volumes, with erase counters and sequence
+ * numbers - which is stored in a few PEBs so that attaching only has to read
+ * these and the PEBs which changed since the snapshot was taken.
+ *
+ * The fastmap consists of the anchor PEB, which is one of the first
+ * %UBI_FM_MAX_START PEBs and starts with the super block, and of the data
+ * PEBs the anchor points to. When the device is attached, the first
+ * %UBI_FM_MAX_START PEBs are checked for an anchor; if there is none, or the
+ * fastmap is inconsistent, the whole device is scanned as usual.
+ *
+ * For the fastmap to stay correct until the next one is written, the run-time
+ * code keeps two rules while a fastmap is on the flash (@ubi->fm_active):
+ *   o new PEBs are only taken from the fastmap pool, a set of free PEBs the
+ *     fastmap does not mention, so that they are scanned at attach time;
+ *   o PEBs the fastmap records as used are not erased when they are put, but
+ *     held back until the next fastmap is written.
+ * A new fastmap is written when the pool is used up or too many PEBs are held
+ * back. Before that, the anchor of the old fastmap is erased, so an unclean
+ * reboot while the new one is being written simply results in a full scan.
+ * For the same reason the anchor is erased right after it has been used for
+ * attaching.
+ *
+ * Note, un-mapped LEBs which had not yet been erased may re-appear after an
+ * unclean reboot, just as they do with full scanning.
+ */
+
+#include <linux/crc32.h>
+#include <linux/bitops.h>
+#include "ubi.h"
+
+/**
+ * fm_take - take the next record out of the fastmap buffer.
+ * @buf: the fastmap buffer
+ * @pos: current position in @buf, advanced by @len
+ * @size: size of the data in @buf
+ * @len: size of the record
+ *
+ * Returns a pointer to the record or %NULL if the fastmap is too short.
+ */
+static void *fm_take(void *buf, int *pos, int size, int len)
+{
+	void *p = buf + *pos;
+
+	if (*pos + len > size)
+		return NULL;
+	*pos += len;
+	return p;
+}
+
+/**
+ * fm_add_peb - add a PEB described by the fastmap to the scanning information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: bitmap of the PEBs the fastmap already described
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ * @list: list to add @pnum to or %NULL if the caller adds it
+ *
+ * Returns zero in case of success, %UBI_BAD_FASTMAP if the record does not
+ * make sense and a negative error code in case of failure.
+ */
+static int fm_add_peb(struct ubi_device *ubi, struct ubi_scan_info *si,
+		      unsigned long *seen, int pnum, int ec,
+		      struct list_head *list)
+{
+	int err;
+
+	if (pnum < 0 || pnum >= ubi->peb_count || test_bit(pnum, seen) ||
+	    ec < 0 || ec > UBI_MAX_ERASECOUNTER) {
+		ubi_err("bad fastmap record: PEB %d, EC %d", pnum, ec);
+		return UBI_BAD_FASTMAP;
+	}
+	set_bit(pnum, seen);
+
+	err = ubi_io_is_bad(ubi, pnum);
+	if (err < 0)
+		return err;
+	if (err) {
+		/* A PEB to erase might have gone bad in the meantime */
+		if (list != &si->erase) {
+			ubi_err("fastmap PEB %d is bad", pnum);
+			return UBI_BAD_FASTMAP;
+		}
+		si->bad_peb_count += 1;
+		return 0;
+	}
+
+	if (list) {
+		err = ubi_scan_add_to_list(si, pnum, ec, list);
+		if (err)
+			return err;
+	}
+
+	si->is_empty = 0;
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+	return 0;
+}
+
+/**
+ * fm_add_ec_records - add free or to be erased PEB records.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: bitmap of the PEBs the fastmap already described
+ * @buf: the fastmap data
+ * @pos: current position in @buf
+ * @size: size of the fastmap data
+ * @count: number of records
+ * @list: list to add the PEBs to
+ *
+ * Returns zero in case of success, %UBI_BAD_FASTMAP if the fastmap is
+ * inconsistent and a negative error code in case of failure.
+ */
+static int fm_add_ec_records(struct ubi_device *ubi, struct ubi_scan_info *si,
+			     unsigned long *seen, void *buf, int *pos,
+			     int size, int count, struct list_head *list)
+{
+	int i, err;
+	struct ubi_fm_ec *fmec;
+
+	for (i = 0; i < count; i++) {
+		fmec = fm_take(buf, pos, size, sizeof(struct ubi_fm_ec));
+		if (!fmec)
+			return UBI_BAD_FASTMAP;
+
+		err = fm_add_peb(ubi, si, seen, be32_to_cpu(fmec->pnum),
+				 be32_to_cpu(fmec->ec), list);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * fm_add_volume - add a volume and its LEB records.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: bitmap of the PEBs the fastmap already described
+ * @buf: the fastmap data
+ * @pos: current position in @buf
+ * @size: size of the fastmap data
+ * @vid_hdr: VID header buffer to use
+ *
+ * The VID header of every LEB is re-created from the volume record, so that
+ * the LEB is added exactly like a scanned one would be.
+ *
+ * Returns zero in case of success, %UBI_BAD_FASTMAP if the fastmap is
+ * inconsistent and a negative error code in case of failure.
+ */
+static int fm_add_volume(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 unsigned long *seen, void *buf, int *pos, int size,
+			 struct ubi_vid_hdr *vid_hdr)
+{
+	int i, err, vol_id, leb_count, used_ebs, lnum, pnum, ec;
+	struct ubi_fm_volume *fmv;
+	struct ubi_fm_leb *fml;
+
+	fmv = fm_take(buf, pos, size, sizeof(struct ubi_fm_volume));
+	if (!fmv || be32_to_cpu(fmv->magic) != UBI_FM_VHDR_MAGIC)
+		return UBI_BAD_FASTMAP;
+
+	vol_id = be32_to_cpu(fmv->vol_id);
+	leb_count = be32_to_cpu(fmv->leb_count);
+	used_ebs = be32_to_cpu(fmv->used_ebs);
+	if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+	    vol_id != UBI_LAYOUT_VOLUME_ID)
+		return UBI_BAD_FASTMAP;
+	if (fmv->vol_type != UBI_VID_DYNAMIC &&
+	    fmv->vol_type != UBI_VID_STATIC)
+		return UBI_BAD_FASTMAP;
+
+	for (i = 0; i < leb_count; i++) {
+		fml = fm_take(buf, pos, size, sizeof(struct ubi_fm_leb));
+		if (!fml)
+			return UBI_BAD_FASTMAP;
+
+		lnum = be32_to_cpu(fml->lnum);
+		pnum = be32_to_cpu(fml->pnum);
+		ec = be32_to_cpu(fml->ec);
+		if (lnum < 0)
+			return UBI_BAD_FASTMAP;
+
+		err = fm_add_peb(ubi, si, seen, pnum, ec, NULL);
+		if (err)
+			return err;
+
+		memset(vid_hdr, 0, sizeof(struct ubi_vid_hdr));
+		vid_hdr->vol_type = fmv->vol_type;
+		vid_hdr->compat = fmv->compat;
+		vid_hdr->vol_id = fmv->vol_id;
+		vid_hdr->lnum = fml->lnum;
+		vid_hdr->data_pad = fmv->data_pad;
+		vid_hdr->sqnum = fml->sqnum;
+		if (fmv->vol_type == UBI_VID_STATIC) {
+			vid_hdr->used_ebs = fmv->used_ebs;
+			if (lnum == used_ebs - 1)
+				vid_hdr->data_size = fmv->last_eb_bytes;
+			else
+				vid_hdr->data_size = cpu_to_be32(ubi->leb_size -
+						be32_to_cpu(fmv->data_pad));
+		}
+
+		err = ubi_scan_add_used(ubi, si, pnum, ec, vid_hdr, 0);
+		if (err)
+			return err == -EINVAL ? UBI_BAD_FASTMAP : err;
+	}
+
+	return 0;
+}
+
+/**
+ * find_anchor - find the fastmap anchor PEB.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ *
+ * Returns the anchor PEB number, %-ENOENT if there is no anchor and
+ * %-EEXIST if there are several. Other negative error codes are returned in
+ * case of failure.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr)
+{
+	int err, pnum, anchor = -ENOENT;
+
+	for (pnum = 0; pnum < UBI_FM_MAX_START && pnum < ubi->peb_count;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		/*
+		 * There may be only one anchor, the old one is erased before
+		 * a new fastmap is written.
+		 */
+		if (anchor >= 0)
+			return -EEXIST;
+		anchor = pnum;
+	}
+
+	return anchor;
+}
+
+/**
+ * read_fastmap - read the fastmap data.
+ * @ubi: UBI device description object
+ * @anchor: the anchor PEB
+ * @vid_hdr: VID header buffer to use
+ * @bufp: the buffer with the data is returned here
+ *
+ * This function reads and checks the super block and then reads the whole
+ * fastmap into a vmalloc'ed buffer, which is returned in @bufp. Returns
+ * zero in case of success, %UBI_BAD_FASTMAP if the fastmap is corrupted and a
+ * negative error code in case of failure.
+ */
+static int read_fastmap(struct ubi_device *ubi, int anchor,
+			struct ubi_vid_hdr *vid_hdr, void **bufp)
+{
+	int err, i, used_blocks, data_size, pnum, len;
+	struct ubi_fm_sb *fmsb;
+	void *buf;
+	uint32_t crc;
+
+	fmsb = kmalloc(sizeof(struct ubi_fm_sb), GFP_KERNEL);
+	if (!fmsb)
+		return -ENOMEM;
+
+	err = ubi_io_read_data(ubi, fmsb, anchor, 0, sizeof(struct ubi_fm_sb));
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_bad;
+
+	used_blocks = be32_to_cpu(fmsb->used_blocks);
+	data_size = be32_to_cpu(fmsb->data_size);
+	if (be32_to_cpu(fmsb->magic) != UBI_FM_SB_MAGIC ||
+	    fmsb->version != UBI_FM_FMT_VERSION ||
+	    used_blocks < 1 || used_blocks > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(fmsb->block_loc[0]) != anchor ||
+	    data_size < (int)(sizeof(struct ubi_fm_sb) +
+			      sizeof(struct ubi_fm_hdr)) ||
+	    data_size > used_blocks * ubi->leb_size) {
+		ubi_err("bad fastmap super block in PEB %d", anchor);
+		goto out_bad;
+	}
+
+	buf = vmalloc(data_size);
+	if (!buf) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < used_blocks; i++) {
+		pnum = be32_to_cpu(fmsb->block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_bad_buf;
+
+		if (i) {
+			err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+			if (err < 0)
+				goto out_buf;
+			if ((err && err != UBI_IO_BITFLIPS) ||
+			    be32_to_cpu(vid_hdr->vol_id) !=
+						UBI_FM_DATA_VOLUME_ID ||
+			    be32_to_cpu(vid_hdr->lnum) != i) {
+				ubi_err("fastmap PEB %d is not data block %d",
+					pnum, i);
+				goto out_bad_buf;
+			}
+		}
+
+		len = min(data_size - i * ubi->leb_size, ubi->leb_size);
+		if (len <= 0)
+			continue;
+
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       len);
+		if (err == -EBADMSG)
+			goto out_bad_buf;
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_buf;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_sb),
+		    data_size - sizeof(struct ubi_fm_sb));
+	if (crc != be32_to_cpu(fmsb->data_crc)) {
+		ubi_err("bad fastmap CRC %#08x, expected %#08x", crc,
+			be32_to_cpu(fmsb->data_crc));
+		goto out_bad_buf;
+	}
+
+	kfree(fmsb);
+	*bufp = buf;
+	return 0;
+
+out_bad_buf:
+	err = UBI_BAD_FASTMAP;
+out_buf:
+	vfree(buf);
+	goto out_free;
+out_bad:
+	if (err != -ENOMEM)
+		err = UBI_BAD_FASTMAP;
+out_free:
+	kfree(fmsb);
+	return err;
+}
+
+/**
+ * ubi_scan_fastmap - attach using the fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @seen: bitmap of PEBs described by the fastmap
+ *
+ * This function looks for the fastmap anchor, reads the fastmap and adds all
+ * the PEBs it describes to @si, marking them in @seen. The caller has to scan
+ * the remaining PEBs. The anchor is erased once the fastmap has been loaded.
+ *
+ * Returns zero in case of success, %UBI_NO_FASTMAP if there is no fastmap,
+ * %UBI_BAD_FASTMAP if it cannot be used and a negative error code in case of
+ * failure. In the last two cases @si may be partially filled.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si,
+		     unsigned long *seen)
+{
+	int err, anchor, pos, size, i, image_seq, ec, count, used_blocks;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_ec_hdr *ec_hdr;
+	struct ubi_fm_sb *fmsb;
+	struct ubi_fm_hdr *fmhdr;
+	void *buf = NULL;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr) {
+		kfree(ec_hdr);
+		return -ENOMEM;
+	}
+
+	anchor = find_anchor(ubi, vid_hdr);
+	if (anchor == -ENOENT) {
+		err = UBI_NO_FASTMAP;
+		goto out;
+	} else if (anchor == -EEXIST) {
+		ubi_err("several fastmap anchors found");
+		err = UBI_BAD_FASTMAP;
+		goto out;
+	} else if (anchor < 0) {
+		err = anchor;
+		goto out;
+	}
+
+	/* find_anchor() scanned on past the anchor, re-read its VID header */
+	err = ubi_io_read_vid_hdr(ubi, anchor, vid_hdr, 0);
+	if (err < 0)
+		goto out;
+	if (err && err != UBI_IO_BITFLIPS) {
+		err = UBI_BAD_FASTMAP;
+		goto out;
+	}
+	si->max_sqnum = be64_to_cpu(vid_hdr->sqnum);
+
+	/* The image sequence number is taken from the anchor EC header */
+	err = ubi_io_read_ec_hdr(ubi, anchor, ec_hdr, 0);
+	if (err < 0)
+		goto out;
+	if ((err && err != UBI_IO_BITFLIPS) ||
+	    ec_hdr->version != UBI_VERSION) {
+		err = UBI_BAD_FASTMAP;
+		goto out;
+	}
+	image_seq = be32_to_cpu(ec_hdr->image_seq);
+	if (!ubi->image_seq)
+		ubi->image_seq = image_seq;
+
+	err = read_fastmap(ubi, anchor, vid_hdr, &buf);
+	if (err)
+		goto out;
+
+	fmsb = buf;
+	size = be32_to_cpu(fmsb->data_size);
+	used_blocks = be32_to_cpu(fmsb->used_blocks);
+	if (be64_to_cpu(fmsb->sqnum) > si->max_sqnum)
+		si->max_sqnum = be64_to_cpu(fmsb->sqnum);
+
+	pos = sizeof(struct ubi_fm_sb);
+	fmhdr = fm_take(buf, &pos, size, sizeof(struct ubi_fm_hdr));
+	err = UBI_BAD_FASTMAP;
+	if (be32_to_cpu(fmhdr->magic) != UBI_FM_HDR_MAGIC ||
+	    be32_to_cpu(fmhdr->peb_count) != ubi->peb_count) {
+		ubi_err("fastmap does not match this device");
+		goto out;
+	}
+
+	/* The fastmap PEBs themselves, the anchor is handled at the end */
+	ec = be32_to_cpu(fmsb->block_ec[0]);
+	err = fm_add_peb(ubi, si, seen, anchor, ec, NULL);
+	if (err)
+		goto out;
+	for (i = 1; i < used_blocks; i++) {
+		err = fm_add_peb(ubi, si, seen, be32_to_cpu(fmsb->block_loc[i]),
+				 be32_to_cpu(fmsb->block_ec[i]), &si->erase);
+		if (err)
+			goto out;
+	}
+
+	err = fm_add_ec_records(ubi, si, seen, buf, &pos, size,
+				be32_to_cpu(fmhdr->free_peb_count), &si->free);
+	if (err)
+		goto out;
+
+	err = fm_add_ec_records(ubi, si, seen, buf, &pos, size,
+				be32_to_cpu(fmhdr->erase_peb_count),
+				&si->erase);
+	if (err)
+		goto out;
+
+	count = be32_to_cpu(fmhdr->vol_count);
+	for (i = 0; i < count; i++) {
+		err = fm_add_volume(ubi, si, seen, buf, &pos, size, vid_hdr);
+		if (err)
+			goto out;
+	}
+
+	/*
+	 * The fastmap is loaded. Now get rid of the anchor, from now on the
+	 * PEBs it describes may change. If it cannot be erased, the device is
+	 * read-only and nothing changes.
+	 */
+	if (ubi->ro_mode)
+		err = ubi_scan_add_to_list(si, anchor, ec, &si->erase);
+	else {
+		err = ubi_scan_erase_peb(ubi, si, anchor, ec + 1);
+		if (!err)
+			err = ubi_scan_add_to_list(si, anchor, ec + 1,
+						   &si->free);
+	}
+	if (err)
+		goto out;
+
+	ubi_msg("attached by fastmap from PEB %d, %d PEBs to scan", anchor,
+		ubi->peb_count - bitmap_weight(seen, ubi->peb_count));
+
+out:
+	vfree(buf);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	kfree(ec_hdr);
+	return err;
+}
+
+/**
+ * ubi_fastmap_init - initialize the fastmap sub-system.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function has to be called after the WL and EBA sub-systems were
+ * initialized. It reserves PEBs for the fastmap and its pool and allocates
+ * the fastmap buffers. If the device cannot have a fastmap, fastmap is just
+ * disabled. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int blocks, rsvd;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+
+	INIT_LIST_HEAD(&ubi->fm_held);
+	if (ubi->fm_disabled)
+		return 0;
+
+	if (si->alien_peb_count) {
+		/* The fastmap cannot describe PEBs UBI does not own */
+		ubi_msg("fastmap disabled, alien PEBs found");
+		goto out_disable;
+	}
+
+	ubi->fm_size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+		       ubi->peb_count * sizeof(struct ubi_fm_leb) +
+		       (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+		       sizeof(struct ubi_fm_volume);
+	ubi->fm_size = roundup(ubi->fm_size, ubi->leb_size);
+	blocks = ubi->fm_size / ubi->leb_size;
+	if (blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_msg("fastmap disabled, the device is too large");
+		goto out_disable;
+	}
+
+	ubi->fm_pool_max = ubi->peb_count * UBI_FM_POOL_PERCENT / 100;
+	ubi->fm_pool_max = clamp(ubi->fm_pool_max, UBI_FM_MIN_POOL_SIZE,
+				 UBI_FM_MAX_POOL_SIZE);
+
+	/*
+	 * The pool and the held back PEBs are not available to users, and an
+	 * update needs a second set of data blocks while the old ones wait
+	 * for erasure.
+	 */
+	rsvd = ubi->fm_pool_max + 2 * blocks;
+	spin_lock(&ubi->volumes_lock);
+	if (ubi->avail_pebs < rsvd) {
+		spin_unlock(&ubi->volumes_lock);
+		ubi_msg("fastmap disabled, %d PEBs needed, only %d available",
+			rsvd, ubi->avail_pebs);
+		goto out_disable;
+	}
+	ubi->avail_pebs -= rsvd;
+	ubi->rsvd_pebs += rsvd;
+	spin_unlock(&ubi->volumes_lock);
+
+	ubi->fm_used = kzalloc(BITS_TO_LONGS(ubi->peb_count) * sizeof(long),
+			       GFP_KERNEL);
+	ubi->fm_sqnum = vmalloc(ubi->peb_count * sizeof(unsigned long long));
+	ubi->fm_buf = vmalloc(ubi->fm_size);
+	if (!ubi->fm_used || !ubi->fm_sqnum || !ubi->fm_buf) {
+		ubi_fastmap_close(ubi);
+		return -ENOMEM;
+	}
+
+	memset(ubi->fm_sqnum, 0, ubi->peb_count * sizeof(unsigned long long));
+	ubi_rb_for_each_entry(rb1, sv, &si->volumes, rb)
+		ubi_rb_for_each_entry(rb2, seb, &sv->root, u.rb)
+			ubi->fm_sqnum[seb->pnum] = seb->sqnum;
+
+	dbg_msg("fastmap: %d blocks, pool of %d PEBs", blocks,
+		ubi->fm_pool_max);
+	return 0;
+
+out_disable:
+	ubi->fm_disabled = 1;
+	return 0;
+}
+
+/**
+ * fm_write_block - write one PEB of the fastmap.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ * @i: index of the block, %0 is the anchor
+ * @pnum: the PEB to write to
+ * @sqnum: sequence number for the VID header
+ * @data_size: total size of the fastmap data in @ubi->fm_buf
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int fm_write_block(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+			  int i, int pnum, unsigned long long sqnum,
+			  int data_size)
+{
+	int err, len;
+
+	memset(vid_hdr, 0, sizeof(struct ubi_vid_hdr));
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+					  UBI_FM_SB_VOLUME_ID);
+	vid_hdr->lnum = cpu_to_be32(i);
+	vid_hdr->compat = UBI_FM_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(sqnum);
+
+	err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+	if (err)
+		return err;
+
+	len = min(data_size - i * ubi->leb_size, ubi->leb_size);
+	if (len <= 0)
+		return 0;
+
+	return ubi_io_write_data(ubi, ubi->fm_buf + i * ubi->leb_size, pnum, 0,
+				 ALIGN(len, ubi->min_io_size));
+}
+
+/**
+ * fm_fill - take the fastmap snapshot.
+ * @ubi: UBI device description object
+ * @release: PEBs which have to be recorded for erasure
+ *
+ * This function fills @ubi->fm_buf, except for the super block, and activates
+ * the new fastmap rules. EBA tables must not change meanwhile, i.e.
+ * @ubi->fm_sem has to be locked for writing. Returns the size of the fastmap
+ * data.
+ */
+static int fm_fill(struct ubi_device *ubi, struct list_head *release)
+{
+	int i, lnum, pnum, pos, free_count = 0, erase_count = 0, used_count = 0;
+	int vol_count = 0, leb_count;
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_ec *fmec;
+	struct ubi_fm_volume *fmv;
+	struct ubi_fm_leb *fml;
+	struct ubi_wl_entry *e;
+	struct ubi_volume *vol;
+	struct rb_node *rb;
+	void *buf = ubi->fm_buf;
+
+	pos = sizeof(struct ubi_fm_sb);
+	fmhdr = buf + pos;
+	pos += sizeof(struct ubi_fm_hdr);
+
+	spin_lock(&ubi->wl_lock);
+	ubi_wl_fill_fm_pool(ubi);
+	ubi->fm_active = 1;
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb) {
+		fmec = buf + pos;
+		fmec->pnum = cpu_to_be32(e->pnum);
+		fmec->ec = cpu_to_be32(e->ec);
+		pos += sizeof(struct ubi_fm_ec);
+		free_count += 1;
+	}
+
+	list_for_each_entry(e, release, u.list) {
+		fmec = buf + pos;
+		fmec->pnum = cpu_to_be32(e->pnum);
+		fmec->ec = cpu_to_be32(e->ec);
+		pos += sizeof(struct ubi_fm_ec);
+		erase_count += 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	spin_lock(&ubi->volumes_lock);
+	bitmap_zero(ubi->fm_used, ubi->peb_count);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		fmv = buf + pos;
+		pos += sizeof(struct ubi_fm_volume);
+		leb_count = 0;
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+
+			fml = buf + pos;
+			fml->lnum = cpu_to_be32(lnum);
+			fml->pnum = cpu_to_be32(pnum);
+			fml->ec = cpu_to_be32(ubi->lookuptbl[pnum]->ec);
+			fml->sqnum = cpu_to_be64(ubi->fm_sqnum[pnum]);
+			pos += sizeof(struct ubi_fm_leb);
+			set_bit(pnum, ubi->fm_used);
+			leb_count += 1;
+		}
+
+		if (!leb_count) {
+			pos -= sizeof(struct ubi_fm_volume);
+			continue;
+		}
+
+		memset(fmv, 0, sizeof(struct ubi_fm_volume));
+		fmv->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		fmv->vol_id = cpu_to_be32(vol->vol_id);
+		fmv->compat = ubi_get_compat(ubi, vol->vol_id);
+		fmv->data_pad = cpu_to_be32(vol->data_pad);
+		fmv->leb_count = cpu_to_be32(leb_count);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			fmv->vol_type = UBI_VID_DYNAMIC;
+		else {
+			fmv->vol_type = UBI_VID_STATIC;
+			fmv->used_ebs = cpu_to_be32(vol->updating ?
+						    vol->upd_ebs :
+						    vol->used_ebs);
+			fmv->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		}
+		used_count += leb_count;
+		vol_count += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	memset(fmhdr, 0, sizeof(struct ubi_fm_hdr));
+	fmhdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmhdr->peb_count = cpu_to_be32(ubi->peb_count);
+	fmhdr->free_peb_count = cpu_to_be32(free_count);
+	fmhdr->erase_peb_count = cpu_to_be32(erase_count);
+	fmhdr->used_peb_count = cpu_to_be32(used_count);
+	fmhdr->vol_count = cpu_to_be32(vol_count);
+
+	return pos;
+}
+
+/**
+ * release_pebs - schedule PEBs the fastmap does not need any more for erasure.
+ * @ubi: UBI device description object
+ * @release: list of the PEBs
+ *
+ * PEBs which cannot be scheduled are held back again and retried with the
+ * next fastmap update.
+ */
+static void release_pebs(struct ubi_device *ubi, struct list_head *release)
+{
+	struct ubi_wl_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, release, u.list) {
+		list_del(&e->u.list);
+		if (ubi_wl_put_fm_peb(ubi, e)) {
+			spin_lock(&ubi->wl_lock);
+			list_add_tail(&e->u.list, &ubi->fm_held);
+			ubi->fm_held_count += 1;
+			spin_unlock(&ubi->wl_lock);
+		}
+	}
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function invalidates the current fastmap, takes a new snapshot and
+ * writes it to the flash. Besides attaching faster, this refills the fastmap
+ * pool and releases the PEBs which were held back for the old fastmap.
+ *
+ * If the new fastmap cannot be written, fastmap is disabled for this device.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err = 0, i, blocks, data_size;
+	unsigned long long sqnum;
+	struct ubi_wl_entry *new_blocks[UBI_FM_MAX_BLOCKS];
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_fm_sb *fmsb;
+	LIST_HEAD(release);
+
+	mutex_lock(&ubi->fm_mutex);
+	if (ubi->ro_mode) {
+		err = -EROFS;
+		goto out_unlock;
+	}
+	if (ubi->fm_disabled)
+		goto out_unlock;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+
+	/*
+	 * Invalidate the old fastmap first. Until it is gone, its rules still
+	 * apply, afterwards nothing on the flash refers to the pool and the
+	 * held back PEBs any more.
+	 */
+	memset(new_blocks, 0, sizeof(new_blocks));
+	if (ubi->fm_used_blocks) {
+		new_blocks[0] = ubi->fm_blocks[0];
+		err = ubi_wl_erase_fm_peb(ubi, new_blocks[0]);
+		if (err) {
+			ubi_err("cannot erase fastmap anchor PEB %d, error %d",
+				new_blocks[0]->pnum, err);
+			ubi_ro_mode(ubi);
+			goto out_free;
+		}
+		for (i = 1; i < ubi->fm_used_blocks; i++)
+			list_add_tail(&ubi->fm_blocks[i]->u.list, &release);
+		ubi->fm_used_blocks = 0;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_active = 0;
+	list_splice_init(&ubi->fm_held, &release);
+	ubi->fm_held_count = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	blocks = ubi->fm_size / ubi->leb_size;
+	if (!new_blocks[0])
+		new_blocks[0] = ubi_wl_get_fm_peb(ubi, 1);
+	for (i = 1; i < blocks && new_blocks[i - 1]; i++)
+		new_blocks[i] = ubi_wl_get_fm_peb(ubi, 0);
+	if (!new_blocks[blocks - 1]) {
+		ubi_warn("no free PEBs for the fastmap");
+		err = -ENOSPC;
+		goto out_disable;
+	}
+
+	down_write(&ubi->fm_sem);
+	data_size = fm_fill(ubi, &release);
+	sqnum = ubi_next_sqnum(ubi);
+	up_write(&ubi->fm_sem);
+
+	release_pebs(ubi, &release);
+
+	fmsb = ubi->fm_buf;
+	memset(fmsb, 0, sizeof(struct ubi_fm_sb));
+	fmsb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	fmsb->version = UBI_FM_FMT_VERSION;
+	fmsb->data_size = cpu_to_be32(data_size);
+	fmsb->used_blocks = cpu_to_be32(blocks);
+	fmsb->sqnum = cpu_to_be64(sqnum);
+	for (i = 0; i < blocks; i++) {
+		fmsb->block_loc[i] = cpu_to_be32(new_blocks[i]->pnum);
+		fmsb->block_ec[i] = cpu_to_be32(new_blocks[i]->ec);
+	}
+	memset(ubi->fm_buf + data_size, 0,
+	       ALIGN(data_size, ubi->min_io_size) - data_size);
+	fmsb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT,
+				ubi->fm_buf + sizeof(struct ubi_fm_sb),
+				data_size - sizeof(struct ubi_fm_sb)));
+
+	/* Data blocks go first, the fastmap is valid once the anchor is */
+	for (i = blocks - 1; i >= 0; i--) {
+		err = fm_write_block(ubi, vid_hdr, i, new_blocks[i]->pnum,
+				     i ? ubi_next_sqnum(ubi) : sqnum,
+				     data_size);
+		if (err) {
+			ubi_warn("cannot write fastmap block %d to PEB %d",
+				 i, new_blocks[i]->pnum);
+			goto out_disable;
+		}
+	}
+
+	memcpy(ubi->fm_blocks, new_blocks, sizeof(new_blocks));
+	ubi->fm_used_blocks = blocks;
+	dbg_msg("fastmap written to PEB %d, %d bytes", new_blocks[0]->pnum,
+		data_size);
+	goto out_free;
+
+out_disable:
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_active = 0;
+	ubi_wl_drain_fm_pool(ubi);
+	list_splice_init(&ubi->fm_held, &release);
+	ubi->fm_held_count = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	for (i = 0; i < blocks && new_blocks[i]; i++)
+		list_add_tail(&new_blocks[i]->u.list, &release);
+	ubi->fm_disabled = 1;
+	release_pebs(ubi, &release);
+	ubi_warn("fastmap disabled");
+out_free:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	return err;
+}
+
+/**
+ * ubi_fastmap_close - close the fastmap sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function frees the fastmap buffers and the PEBs which are kept out of
+ * the WL sub-system for the fastmap. It has to be called after the WL
+ * sub-system was closed and may be called several times.
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_wl_entry *e, *tmp;
+
+	for (i = 0; i < ubi->fm_pool_count; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_pool[i]);
+	ubi->fm_pool_count = 0;
+
+	list_for_each_entry_safe(e, tmp, &ubi->fm_held, u.list) {
+		list_del(&e->u.list);
+		kmem_cache_free(ubi_wl_entry_slab, e);
+	}
+	ubi->fm_held_count = 0;
+
+	for (i = 0; i < ubi->fm_used_blocks; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_blocks[i]);
+	ubi->fm_used_blocks = 0;
+
+	kfree(ubi->fm_used);
+	vfree(ubi->fm_sqnum);
+	vfree(ubi->fm_buf);
+	ubi->fm_used = NULL;
+	ubi->fm_sqnum = NULL;
+	ubi->fm_buf = NULL;
+}
@@ -1097,6 +1097,11 @@ int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 	p = (char *)vid_hdr - ubi->vid_hdr_shift;
 	err = ubi_io_write(ubi, p, pnum, ubi->vid_hdr_aloffset,
 			   ubi->vid_hdr_alsize);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* The fastmap records the sequence number of every used PEB */
+	if (!err && ubi->fm_sqnum)
+		ubi->fm_sqnum[pnum] = be64_to_cpu(vid_hdr->sqnum);
+#endif
 	return err;
 }
 
@@ -56,7 +56,7 @@ static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
 /**
- * add_to_list - add physical eraseblock to a list.
+ * ubi_scan_add_to_list - add physical eraseblock to a list.
  * @si: scanning information
  * @pnum: physical eraseblock number to add
  * @ec: erase counter of the physical eraseblock
@@ -66,8 +66,8 @@ static struct ubi_vid_hdr *vidh;
  * alien lists. Returns zero in case of success and a negative error code in
  * case of failure.
  */
-static int add_to_list(struct ubi_scan_info *si, int pnum, int ec,
-		       struct list_head *list)
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list)
 {
 	struct ubi_scan_leb *seb;
 
@@ -459,11 +459,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 				return err;
 
 			if (cmp_res & 4)
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->corr);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->corr);
 			else
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->erase);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->erase);
 			if (err)
 				return err;
 
@@ -483,9 +483,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 * previously.
 			 */
 			if (cmp_res & 4)
-				return add_to_list(si, pnum, ec, &si->corr);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->corr);
 			else
-				return add_to_list(si, pnum, ec, &si->erase);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->erase);
 		}
 	}
 
@@ -743,7 +745,8 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	else if (err == UBI_IO_BITFLIPS)
 		bitflips = 1;
 	else if (err == UBI_IO_PEB_EMPTY)
-		return add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC, &si->erase);
+		return ubi_scan_add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC,
+					    &si->erase);
 	else if (err == UBI_IO_BAD_EC_HDR) {
 		/*
 		 * We have to also look at the VID header, possibly it is not
@@ -815,19 +818,42 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	else if (err == UBI_IO_BAD_VID_HDR ||
 		 (err == UBI_IO_PEB_FREE && ec_corr)) {
 		/* VID header is corrupted */
-		err = add_to_list(si, pnum, ec, &si->corr);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	} else if (err == UBI_IO_PEB_FREE) {
 		/* No VID header - the physical eraseblock is free */
-		err = add_to_list(si, pnum, ec, &si->free);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->free);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (vol_id == UBI_FM_SB_VOLUME_ID && !ec_corr && !ubi->ro_mode) {
+		/*
+		 * The anchor of a fastmap which was not used. The PEBs it
+		 * describes are about to change, so it is erased right away,
+		 * otherwise the next attach could trust an outdated fastmap.
+		 */
+		dbg_bld("erase fastmap anchor PEB %d", pnum);
+		err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+		if (err)
+			return err;
+		err = ubi_scan_add_to_list(si, pnum, ec + 1, &si->free);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	} else if (vol_id == UBI_FM_SB_VOLUME_ID ||
+		   vol_id == UBI_FM_DATA_VOLUME_ID) {
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+#endif
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -836,7 +862,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, remove it", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->corr);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 			if (err)
 				return err;
 			break;
@@ -851,7 +877,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		case UBI_COMPAT_PRESERVE:
 			ubi_msg("\"preserve\" compatible internal volume %d:%d"
 				" found", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->alien);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->alien);
 			if (err)
 				return err;
 			si->alien_peb_count += 1;
@@ -884,32 +910,51 @@ adjust_mean_ec:
 	return 0;
 }
 
+/**
+ * alloc_si - allocate empty scanning information.
+ *
+ * Returns the new object or %NULL if there is no memory.
+ */
+static struct ubi_scan_info *alloc_si(void)
+{
+	struct ubi_scan_info *si;
+
+	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	if (!si)
+		return NULL;
+
+	INIT_LIST_HEAD(&si->corr);
+	INIT_LIST_HEAD(&si->free);
+	INIT_LIST_HEAD(&si->erase);
+	INIT_LIST_HEAD(&si->alien);
+	si->volumes = RB_ROOT;
+	si->is_empty = 1;
+	return si;
+}
+
 /**
  * ubi_scan - scan an MTD device.
  * @ubi: UBI device description object
  *
  * This function does full scanning of an MTD device and returns complete
  * information about it. In case of failure, an error code is returned.
+ *
+ * If there is a fastmap on the device, only the PEBs it does not describe are
+ * scanned.
  */
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 {
 	int err, pnum;
+	unsigned long *seen = NULL;
 	struct rb_node *rb1, *rb2;
 	struct ubi_scan_volume *sv;
 	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
-	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	si = alloc_si();
 	if (!si)
 		return ERR_PTR(-ENOMEM);
 
-	INIT_LIST_HEAD(&si->corr);
-	INIT_LIST_HEAD(&si->free);
-	INIT_LIST_HEAD(&si->erase);
-	INIT_LIST_HEAD(&si->alien);
-	si->volumes = RB_ROOT;
-	si->is_empty = 1;
-
 	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
@@ -919,7 +964,35 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (!vidh)
 		goto out_ech;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		seen = kzalloc(BITS_TO_LONGS(ubi->peb_count) * sizeof(long),
+			       GFP_KERNEL);
+		if (!seen)
+			goto out_vidh;
+
+		err = ubi_scan_fastmap(ubi, si, seen);
+		if (err < 0)
+			goto out_vidh;
+		if (err) {
+			if (err == UBI_BAD_FASTMAP)
+				ubi_warn("fastmap is unusable, scan all PEBs");
+			kfree(seen);
+			seen = NULL;
+
+			ubi_scan_destroy_si(si);
+			si = alloc_si();
+			if (!si) {
+				err = -ENOMEM;
+				goto out_vidh;
+			}
+		}
+	}
+#endif
+
 	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (seen && test_bit(pnum, seen))
+			continue;
 		cond_resched();
 
 		dbg_gen("process PEB %d", pnum);
@@ -980,17 +1053,20 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 		goto out_vidh;
 	}
 
+	kfree(seen);
 	ubi_free_vid_hdr(ubi, vidh);
 	kfree(ech);
 
 	return si;
 
 out_vidh:
+	kfree(seen);
 	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
 	kfree(ech);
 out_si:
-	ubi_scan_destroy_si(si);
+	if (si)
+		ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
 }
 
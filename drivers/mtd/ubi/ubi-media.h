@@ -312,6 +312,18 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap is stored in internal volumes with "delete" compatibility, so
+ * UBI implementations which do not know about it just erase it. The anchor
+ * PEB (logical eraseblock 0 of %UBI_FM_SB_VOLUME_ID) contains the fastmap
+ * super block and has to be one of the first %UBI_FM_MAX_START PEBs, the
+ * rest of the fastmap goes to %UBI_FM_DATA_VOLUME_ID PEBs, which may be
+ * anywhere.
+ */
+#define UBI_FM_SB_VOLUME_ID	(UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID	(UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_COMPAT		UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +387,131 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* The fastmap super block magic number ("UBIS") and the version */
+#define UBI_FM_SB_MAGIC		0x55424953
+#define UBI_FM_FMT_VERSION	1
+
+/* The fastmap header magic number ("UBIH") */
+#define UBI_FM_HDR_MAGIC	0x55424948
+
+/* The fastmap volume record magic number ("UBIV") */
+#define UBI_FM_VHDR_MAGIC	0x55424956
+
+/* How many first PEBs are searched for the fastmap anchor */
+#define UBI_FM_MAX_START	64
+
+/* The maximum number of PEBs a fastmap may occupy, the anchor included */
+#define UBI_FM_MAX_BLOCKS	32
+
+/**
+ * struct ubi_fm_sb - fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @data_crc: CRC checksum of the fastmap data which follows the super block
+ * @data_size: size of the fastmap in bytes, the super block included
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: an array containing the location of all PEBs of the fastmap
+ * @block_ec: the erase counter of each used PEB
+ * @sqnum: highest sequence number value at the time the fastmap was taken
+ * @padding2: reserved for future, zeroes
+ *
+ * The super block lives at the beginning of the data area of the anchor PEB
+ * and describes where the rest of the fastmap is stored. @block_loc[0] is
+ * the anchor PEB itself. The fastmap data is the concatenation of the data
+ * areas of all @used_blocks PEBs in @block_loc order.
+ */
+struct ubi_fm_sb {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  data_crc;
+	__be32  data_size;
+	__be32  used_blocks;
+	__be32  block_loc[UBI_FM_MAX_BLOCKS];
+	__be32  block_ec[UBI_FM_MAX_BLOCKS];
+	__be64  sqnum;
+	__u8    padding2[32];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @peb_count: number of PEBs the UBI device had when the fastmap was taken
+ * @free_peb_count: number of free PEBs known to the fastmap
+ * @erase_peb_count: number of PEBs which have to be erased
+ * @used_peb_count: number of PEBs which contain mapped logical eraseblocks
+ * @vol_count: number of volumes
+ * @padding: reserved for future, zeroes
+ *
+ * The header is followed by @free_peb_count and @erase_peb_count
+ * &struct ubi_fm_ec records, then by @vol_count &struct ubi_fm_volume
+ * records, each followed by its &struct ubi_fm_leb records.
+ *
+ * PEBs which are not mentioned in the fastmap at all (this includes the
+ * pool, the PEBs new data is written to until the next fastmap is taken)
+ * are scanned when the fastmap is attached.
+ */
+struct ubi_fm_hdr {
+	__be32  magic;
+	__be32  peb_count;
+	__be32  free_peb_count;
+	__be32  erase_peb_count;
+	__be32  used_peb_count;
+	__be32  vol_count;
+	__u8    padding[8];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_ec - a free or to be erased PEB record.
+ * @pnum: PEB number
+ * @ec: erase counter
+ */
+struct ubi_fm_ec {
+	__be32  pnum;
+	__be32  ec;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_volume - fastmap volume record.
+ * @magic: fastmap volume record magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding1: reserved for future, zeroes
+ * @data_pad: how many bytes at the end of each PEB are not used
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @last_eb_bytes: how many bytes are stored in the last logical eraseblock
+ *                 (static volumes only)
+ * @leb_count: number of &struct ubi_fm_leb records which follow
+ *
+ * The fields mirror the corresponding fields of the VID headers of the
+ * volume, so that the attach code can re-create the headers.
+ */
+struct ubi_fm_volume {
+	__be32  magic;
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding1[2];
+	__be32  data_pad;
+	__be32  used_ebs;
+	__be32  last_eb_bytes;
+	__be32  leb_count;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_leb - a mapped logical eraseblock record.
+ * @lnum: logical eraseblock number
+ * @pnum: PEB the logical eraseblock is mapped to
+ * @ec: erase counter of the PEB
+ * @sqnum: sequence number of the VID header of the PEB
+ */
+struct ubi_fm_leb {
+	__be32  lnum;
+	__be32  pnum;
+	__be32  ec;
+	__be64  sqnum;
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -65,6 +65,11 @@
 /* Background thread name pattern */
 #define UBI_BGT_NAME_PATTERN "ubi_bgt%dd"
 
+#if CONFIG_MTD_UBI_ERASE_WORKERS > 1
+/* Number of additional background threads which only erase */
+#define UBI_ERASE_THREADS (CONFIG_MTD_UBI_ERASE_WORKERS - 1)
+#endif
+
 /* This marker in the EBA table means that the LEB is um-mapped */
 #define UBI_LEB_UNMAPPED -1
 
@@ -101,6 +106,24 @@ enum {
 	UBI_IO_BITFLIPS
 };
 
+/*
+ * Return codes of 'ubi_scan_fastmap()'.
+ *
+ * UBI_NO_FASTMAP: there is no fastmap on the flash
+ * UBI_BAD_FASTMAP: the fastmap is corrupted or inconsistent
+ */
+enum {
+	UBI_NO_FASTMAP = 1,
+	UBI_BAD_FASTMAP
+};
+
+/*
+ * Fastmap pool size, in percent of all PEBs, and its bounds.
+ */
+#define UBI_FM_POOL_PERCENT 5
+#define UBI_FM_MIN_POOL_SIZE 8
+#define UBI_FM_MAX_POOL_SIZE 256
+
 /*
  * Return codes of the 'ubi_eba_copy_leb()' function.
  *
@@ -329,13 +352,14 @@ struct ubi_wl_entry;
  * @used: RB-tree of used physical eraseblocks
  * @erroneous: RB-tree of erroneous used physical eraseblocks
  * @free: RB-tree of free physical eraseblocks
+ * @free_count: count of physical eraseblocks in the @free RB-tree
  * @scrub: RB-tree of physical eraseblocks which need scrubbing
  * @pq: protection queue (contain physical eraseblocks which are temporarily
  *      protected from the wear-leveling worker)
  * @pq_head: protection queue head
- * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
- * 	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- * 	     @erroneous, and @erroneous_peb_count fields
+ * @wl_lock: protects the @used, @free, @free_count, @pq, @pq_head, @lookuptbl,
+ * 	     @move_from, @move_to, @move_to_put @erase_pending, @wl_scheduled,
+ * 	     @works, @erroneous, and @erroneous_peb_count fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -347,10 +371,31 @@ struct ubi_wl_entry;
  * @works: list of pending works
  * @works_count: count of pending works
  * @bgt_thread: background thread description object
- * @thread_enabled: if the background thread is enabled
+ * @erase_thread: additional background threads which only do erase works
+ * @thread_enabled: if the background threads are enabled
  * @bgt_name: background thread name
  * @reboot_notifier: notifier to terminate background thread before rebooting
  *
+ * @fm_disabled: non-zero if fastmap is not used on this device
+ * @fm_active: non-zero while the fastmap on the flash describes the device,
+ *             i.e., PEBs may only be taken from @fm_pool and PEBs marked in
+ *             @fm_used must not be erased
+ * @fm_mutex: serializes fastmap updates and protects @fm_blocks and
+ *            @fm_used_blocks
+ * @fm_sem: taken for reading around EBA table changes and for writing while
+ *          the fastmap snapshot is taken
+ * @fm_blocks: PEBs of the current fastmap, the anchor comes first
+ * @fm_used_blocks: count of PEBs in @fm_blocks
+ * @fm_pool: free PEBs which are scanned when the fastmap is attached
+ * @fm_pool_count: count of PEBs in @fm_pool
+ * @fm_pool_max: size of @fm_pool
+ * @fm_held: PEBs which were put but are referred to by the fastmap
+ * @fm_held_count: count of PEBs in @fm_held
+ * @fm_used: bitmap of PEBs the fastmap records as used
+ * @fm_sqnum: sequence number of the VID header of each PEB
+ * @fm_buf: buffer the fastmap is built in
+ * @fm_size: size of @fm_buf, a multiple of @leb_size
+ *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
  * @peb_size: physical eraseblock size
@@ -419,6 +464,7 @@ struct ubi_device {
 	struct rb_root used;
 	struct rb_root erroneous;
 	struct rb_root free;
+	int free_count;
 	struct rb_root scrub;
 	struct list_head pq[UBI_PROT_QUEUE_LEN];
 	int pq_head;
@@ -433,10 +479,32 @@ struct ubi_device {
 	struct list_head works;
 	int works_count;
 	struct task_struct *bgt_thread;
+#ifdef UBI_ERASE_THREADS
+	struct task_struct *erase_thread[UBI_ERASE_THREADS];
+#endif
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
 	struct notifier_block reboot_notifier;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Fastmap stuff */
+	int fm_disabled;
+	int fm_active;
+	struct mutex fm_mutex;
+	struct rw_semaphore fm_sem;
+	struct ubi_wl_entry *fm_blocks[UBI_FM_MAX_BLOCKS];
+	int fm_used_blocks;
+	struct ubi_wl_entry *fm_pool[UBI_FM_MAX_POOL_SIZE];
+	int fm_pool_count;
+	int fm_pool_max;
+	struct list_head fm_held;
+	int fm_held_count;
+	unsigned long *fm_used;
+	unsigned long long *fm_sqnum;
+	void *fm_buf;
+	int fm_size;
+#endif
+
 	/* I/O sub-system's stuff */
 	long long flash_size;
 	int peb_count;
@@ -523,6 +591,8 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
+int ubi_get_compat(const struct ubi_device *ubi, int vol_id);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype);
@@ -532,6 +602,29 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+#ifdef UBI_ERASE_THREADS
+void ubi_wl_start_erase_threads(struct ubi_device *ubi);
+void ubi_wl_wake_erase_threads(struct ubi_device *ubi);
+void ubi_wl_stop_erase_threads(struct ubi_device *ubi);
+#else
+static inline void ubi_wl_start_erase_threads(struct ubi_device *ubi) {}
+static inline void ubi_wl_wake_erase_threads(struct ubi_device *ubi) {}
+static inline void ubi_wl_stop_erase_threads(struct ubi_device *ubi) {}
+#endif
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+void ubi_wl_fill_fm_pool(struct ubi_device *ubi);
+void ubi_wl_drain_fm_pool(struct ubi_device *ubi);
+
+/* fastmap.c */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si,
+		     unsigned long *seen);
+int ubi_fastmap_init(struct ubi_device *ubi, struct ubi_scan_info *si);
+int ubi_update_fastmap(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
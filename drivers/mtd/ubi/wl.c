@@ -33,8 +33,11 @@
  *
  * When physical eraseblocks are returned to the WL sub-system by means of the
  * 'ubi_wl_put_peb()' function, they are scheduled for erasure. The erasure is
- * done asynchronously in context of the per-UBI device background thread,
- * which is also managed by the WL sub-system.
+ * done asynchronously in context of the per-UBI device background threads,
+ * which are also managed by the WL sub-system. Erase works are preferred over
+ * wear-leveling while fewer than %UBI_ERASE_POOL physical eraseblocks are
+ * free, and the additional erase threads only do erase works, so that users
+ * rarely have to wait for an erasure in 'ubi_wl_get_peb()'.
  *
  * The wear-leveling is ensured by means of moving the contents of used
  * physical eraseblocks with low erase counter to free physical eraseblocks
@@ -141,6 +144,17 @@
  */
 #define WL_MAX_FAILURES 32
 
+/*
+ * How many free physical eraseblocks the background threads try to keep
+ * ready. Below this, pending erasures are done before wear-leveling.
+ */
+#define UBI_ERASE_POOL CONFIG_MTD_UBI_ERASE_POOL
+
+/* Which pending work 'do_work()' picks */
+#define WORK_FIFO        0 /* the oldest one */
+#define WORK_ERASE_FIRST 1 /* the oldest erase work, or the oldest one */
+#define WORK_ERASE_ONLY  2 /* the oldest erase work, or nothing */
+
 /**
  * struct ubi_work - UBI work description data structure.
  * @list: a link in the list of pending works
@@ -208,14 +222,41 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
+/**
+ * find_work - find the pending work to do next.
+ * @ubi: UBI device description object
+ * @which: which work to pick (%WORK_FIFO, %WORK_ERASE_FIRST or
+ *         %WORK_ERASE_ONLY)
+ *
+ * This function returns the work or %NULL if there is none. Note,
+ * @ubi->wl_lock has to be locked.
+ */
+static struct ubi_work *find_work(struct ubi_device *ubi, int which)
+{
+	struct ubi_work *wrk;
+
+	if (which != WORK_FIFO)
+		list_for_each_entry(wrk, &ubi->works, list)
+			if (wrk->func == &erase_worker)
+				return wrk;
+
+	if (which == WORK_ERASE_ONLY || list_empty(&ubi->works))
+		return NULL;
+	return list_entry(ubi->works.next, struct ubi_work, list);
+}
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
+ * @which: which work to pick, see 'find_work()'
  *
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  */
-static int do_work(struct ubi_device *ubi)
+static int do_work(struct ubi_device *ubi, int which)
 {
 	int err;
 	struct ubi_work *wrk;
@@ -230,13 +271,13 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
+	wrk = find_work(ubi, which);
+	if (!wrk) {
 		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
 	list_del(&wrk->list);
 	ubi->works_count -= 1;
 	ubi_assert(ubi->works_count >= 0);
@@ -260,9 +301,10 @@ static int do_work(struct ubi_device *ubi)
  * @ubi: UBI device description object
  *
  * This function tries to make a free PEB by means of synchronous execution of
- * pending works. This may be needed if, for example the background thread is
- * disabled. Returns zero in case of success and a negative error code in case
- * of failure.
+ * pending works, erasures first. This may be needed if, for example the
+ * background threads are disabled or cannot keep up. If there is nothing left
+ * to do, it waits for the works the background threads are busy with. Returns
+ * zero in case of success and a negative error code in case of failure.
  */
 static int produce_free_peb(struct ubi_device *ubi)
 {
@@ -270,10 +312,23 @@ static int produce_free_peb(struct ubi_device *ubi)
 
 	spin_lock(&ubi->wl_lock);
 	while (!ubi->free.rb_node) {
+		if (list_empty(&ubi->works)) {
+			spin_unlock(&ubi->wl_lock);
+			down_write(&ubi->work_sem);
+			up_write(&ubi->work_sem);
+
+			spin_lock(&ubi->wl_lock);
+			if (!ubi->free.rb_node && list_empty(&ubi->works)) {
+				spin_unlock(&ubi->wl_lock);
+				ubi_err("no free eraseblocks");
+				return -ENOSPC;
+			}
+			continue;
+		}
 		spin_unlock(&ubi->wl_lock);
 
 		dbg_wl("do one work synchronously");
-		err = do_work(ubi);
+		err = do_work(ubi, WORK_ERASE_FIRST);
 		if (err)
 			return err;
 
@@ -377,38 +432,18 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 }
 
 /**
- * ubi_wl_get_peb - get a physical eraseblock.
+ * find_free_peb - pick a free physical eraseblock for the given data type.
  * @ubi: UBI device description object
  * @dtype: type of data which will be stored in this physical eraseblock
  *
- * This function returns a physical eraseblock in case of success and a
- * negative error code in case of failure. Might sleep.
+ * This function returns the free physical eraseblock which suits @dtype best.
+ * The @ubi->free tree must not be empty. Note, @ubi->wl_lock has to be locked.
  */
-int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
+static struct ubi_wl_entry *find_free_peb(struct ubi_device *ubi, int dtype)
 {
-	int err, medium_ec;
+	int medium_ec;
 	struct ubi_wl_entry *e, *first, *last;
 
-	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
-		   dtype == UBI_UNKNOWN);
-
-retry:
-	spin_lock(&ubi->wl_lock);
-	if (!ubi->free.rb_node) {
-		if (ubi->works_count == 0) {
-			ubi_assert(list_empty(&ubi->works));
-			ubi_err("no free eraseblocks");
-			spin_unlock(&ubi->wl_lock);
-			return -ENOSPC;
-		}
-		spin_unlock(&ubi->wl_lock);
-
-		err = produce_free_peb(ubi);
-		if (err < 0)
-			return err;
-		goto retry;
-	}
-
 	switch (dtype) {
 	case UBI_LONGTERM:
 		/*
@@ -449,13 +484,82 @@ retry:
 		BUG();
 	}
 
+	return e;
+}
+
+/**
+ * ubi_wl_get_peb - get a physical eraseblock.
+ * @ubi: UBI device description object
+ * @dtype: type of data which will be stored in this physical eraseblock
+ *
+ * This function returns a physical eraseblock in case of success and a
+ * negative error code in case of failure. Might sleep.
+ *
+ * While there is a fastmap on the flash, physical eraseblocks are only handed
+ * out from the fastmap pool, because these are the only free PEBs which are
+ * scanned when the fastmap is attached. A new fastmap is written when the pool
+ * is used up.
+ */
+int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
+{
+	int err;
+	struct ubi_wl_entry *e;
+
+	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
+		   dtype == UBI_UNKNOWN);
+
+retry:
+	spin_lock(&ubi->wl_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (ubi->fm_active) {
+		if ((!ubi->fm_pool_count ||
+		     ubi->fm_held_count >= ubi->fm_pool_max) &&
+		    ubi->free.rb_node) {
+			/*
+			 * The pool is used up or too many PEBs are waiting
+			 * for the next fastmap to be erased. Writing a new
+			 * fastmap deals with both.
+			 */
+			spin_unlock(&ubi->wl_lock);
+			err = ubi_update_fastmap(ubi);
+			if (err && ubi->fm_active)
+				return err;
+			goto retry;
+		}
+
+		if (ubi->fm_pool_count) {
+			e = ubi->fm_pool[--ubi->fm_pool_count];
+			goto got_peb;
+		}
+	}
+#endif
+	if (!ubi->free.rb_node) {
+		if (ubi->works_count == 0) {
+			ubi_assert(list_empty(&ubi->works));
+			ubi_err("no free eraseblocks");
+			spin_unlock(&ubi->wl_lock);
+			return -ENOSPC;
+		}
+		spin_unlock(&ubi->wl_lock);
+
+		err = produce_free_peb(ubi);
+		if (err < 0)
+			return err;
+		goto retry;
+	}
+
+	e = find_free_peb(ubi, dtype);
 	paranoid_check_in_wl_tree(e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+got_peb:
+#endif
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
@@ -605,7 +709,7 @@ repeat:
  * @wrk: the work to schedule
  *
  * This function adds a work defined by @wrk to the tail of the pending works
- * list.
+ * list. Erase works also wake up the erase threads.
  */
 static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
@@ -613,14 +717,14 @@ static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 	list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
-	if (ubi->thread_enabled)
+	if (ubi->thread_enabled) {
 		wake_up_process(ubi->bgt_thread);
+		if (wrk->func == &erase_worker)
+			ubi_wl_wake_erase_threads(ubi);
+	}
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -629,12 +733,27 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
  *
  * This function returns zero in case of success and a %-ENOMEM in case of
  * failure.
+ *
+ * If the fastmap on the flash says that @e contains data, @e is not erased but
+ * held back until the next fastmap is written, see 'ubi_update_fastmap()'.
  */
 static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 			  int torture)
 {
 	struct ubi_work *wl_wrk;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_active && test_bit(e->pnum, ubi->fm_used)) {
+		dbg_wl("hold PEB %d until the next fastmap", e->pnum);
+		list_add_tail(&e->u.list, &ubi->fm_held);
+		ubi->fm_held_count += 1;
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+	spin_unlock(&ubi->wl_lock);
+#endif
+
 	dbg_wl("schedule erasure of PEB %d, EC %d, torture %d",
 	       e->pnum, e->ec, torture);
 
@@ -650,6 +769,60 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	return 0;
 }
 
+/**
+ * find_wl_target - find the free physical eraseblock to wear-level onto.
+ * @ubi: UBI device description object
+ *
+ * While there is a fastmap on the flash the target has to come from the
+ * fastmap pool, see 'ubi_wl_get_peb()', and this is the pool PEB with the
+ * highest erase counter. Otherwise it is a highly worn-out PEB from the free
+ * tree. Returns %NULL if there is none. Note, @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *find_wl_target(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (ubi->fm_active) {
+		int i, max = 0;
+
+		if (!ubi->fm_pool_count)
+			return NULL;
+		for (i = 1; i < ubi->fm_pool_count; i++)
+			if (ubi->fm_pool[i]->ec > ubi->fm_pool[max]->ec)
+				max = i;
+		return ubi->fm_pool[max];
+	}
+#endif
+	if (!ubi->free.rb_node)
+		return NULL;
+	return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+}
+
+/**
+ * take_wl_target - remove the wear-leveling target from where it was found.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock returned by 'find_wl_target()'
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void take_wl_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (ubi->fm_active) {
+		int i;
+
+		for (i = 0; i < ubi->fm_pool_count; i++)
+			if (ubi->fm_pool[i] == e)
+				break;
+		ubi_assert(i < ubi->fm_pool_count);
+		ubi->fm_pool[i] = ubi->fm_pool[--ubi->fm_pool_count];
+		return;
+	}
+#endif
+	paranoid_check_in_wl_tree(e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
+}
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -698,6 +871,16 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		goto out_cancel;
 	}
 
+	e2 = find_wl_target(ubi);
+	if (!e2) {
+		/*
+		 * The fastmap pool is empty, it is refilled by the next
+		 * write.
+		 */
+		dbg_wl("cancel WL, the fastmap pool is empty");
+		goto out_cancel;
+	}
+
 	if (!ubi->scrub.rb_node) {
 		/*
 		 * Now pick the least worn-out used physical eraseblock and a
@@ -705,7 +888,6 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -720,14 +902,12 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	take_wl_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -955,11 +1135,13 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		/*
 		 * We schedule wear-leveling only if the difference between the
 		 * lowest erase counter of used physical eraseblocks and a high
-		 * erase counter of free physical eraseblocks is greater than
-		 * %UBI_WL_THRESHOLD.
+		 * erase counter of the PEB the worker would move it to is
+		 * greater than %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_target(ubi);
+		if (!e2)
+			goto out_unlock;
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1021,6 +1203,7 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 		spin_lock(&ubi->wl_lock);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1255,6 +1438,120 @@ retry:
 	return ensure_wear_leveling(ubi);
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: if the PEB is going to be the fastmap anchor
+ *
+ * This function takes a free physical eraseblock out of the WL sub-system. The
+ * PEB belongs to none of the WL trees until it is given back by
+ * 'ubi_wl_put_fm_peb()'. Anchor PEBs have to be among the first
+ * %UBI_FM_MAX_START PEBs, the one with the lowest erase counter is picked.
+ * Returns %NULL if there is no suitable PEB.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	int pnum;
+	struct ubi_wl_entry *e = NULL, *e1;
+
+retry:
+	spin_lock(&ubi->wl_lock);
+	if (!ubi->free.rb_node) {
+		if (ubi->works_count == 0) {
+			spin_unlock(&ubi->wl_lock);
+			return NULL;
+		}
+		spin_unlock(&ubi->wl_lock);
+
+		if (produce_free_peb(ubi) < 0)
+			return NULL;
+		goto retry;
+	}
+
+	if (anchor) {
+		for (pnum = 0; pnum < UBI_FM_MAX_START; pnum++) {
+			if (pnum >= ubi->peb_count)
+				break;
+			e1 = ubi->lookuptbl[pnum];
+			if (e1 && in_wl_tree(e1, &ubi->free) &&
+			    (!e || e1->ec < e->ec))
+				e = e1;
+		}
+	} else
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+
+	if (e) {
+		paranoid_check_in_wl_tree(e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+		ubi->free_count -= 1;
+		dbg_wl("fastmap PEB %d EC %d", e->pnum, e->ec);
+	}
+	spin_unlock(&ubi->wl_lock);
+	return e;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a physical eraseblock which was used by fastmap.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to return
+ *
+ * This function schedules @e for erasure. Returns zero in case of success and
+ * a negative error code in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	return schedule_erase(ubi, e, 0);
+}
+
+/**
+ * ubi_wl_erase_fm_peb - synchronously erase a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to erase
+ *
+ * The physical eraseblock stays out of the WL trees, so it may be re-used by
+ * the fastmap. Returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	return sync_erase(ubi, e, 0);
+}
+
+/**
+ * ubi_wl_fill_fm_pool - refill the fastmap pool from the free tree.
+ * @ubi: UBI device description object
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+void ubi_wl_fill_fm_pool(struct ubi_device *ubi)
+{
+	struct ubi_wl_entry *e;
+
+	while (ubi->fm_pool_count < ubi->fm_pool_max && ubi->free.rb_node) {
+		e = find_free_peb(ubi, UBI_UNKNOWN);
+		paranoid_check_in_wl_tree(e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+		ubi->free_count -= 1;
+		ubi->fm_pool[ubi->fm_pool_count++] = e;
+	}
+}
+
+/**
+ * ubi_wl_drain_fm_pool - give the fastmap pool back to the free tree.
+ * @ubi: UBI device description object
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+void ubi_wl_drain_fm_pool(struct ubi_device *ubi)
+{
+	while (ubi->fm_pool_count) {
+		wl_tree_add(ubi->fm_pool[--ubi->fm_pool_count], &ubi->free);
+		ubi->free_count += 1;
+	}
+}
+#endif
+
 /**
  * ubi_wl_flush - flush all pending works.
  * @ubi: UBI device description object
@@ -1272,7 +1569,7 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	 */
 	dbg_wl("flush (%d pending works)", ubi->works_count);
 	while (ubi->works_count) {
-		err = do_work(ubi);
+		err = do_work(ubi, WORK_FIFO);
 		if (err)
 			return err;
 	}
@@ -1290,7 +1587,7 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	 */
 	while (ubi->works_count) {
 		dbg_wl("flush more (%d pending works)", ubi->works_count);
-		err = do_work(ubi);
+		err = do_work(ubi, WORK_FIFO);
 		if (err)
 			return err;
 	}
@@ -1330,16 +1627,16 @@ static void tree_destroy(struct rb_root *root)
 }
 
 /**
- * ubi_thread - UBI background thread.
- * @u: the UBI device description object pointer
+ * thread_loop - the main loop of the UBI background threads.
+ * @ubi: UBI device description object
+ * @erase_only: non-zero if only erase works have to be done
  */
-int ubi_thread(void *u)
+static void thread_loop(struct ubi_device *ubi, int erase_only)
 {
-	int failures = 0;
-	struct ubi_device *ubi = u;
+	int failures = 0, which;
 
 	ubi_msg("background thread \"%s\" started, PID %d",
-		ubi->bgt_name, task_pid_nr(current));
+		current->comm, task_pid_nr(current));
 
 	set_freezable();
 	for (;;) {
@@ -1352,7 +1649,13 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
+		if (erase_only)
+			which = WORK_ERASE_ONLY;
+		else if (ubi->free_count < UBI_ERASE_POOL)
+			which = WORK_ERASE_FIRST;
+		else
+			which = WORK_FIFO;
+		if (!find_work(ubi, which) || ubi->ro_mode ||
 			       !ubi->thread_enabled) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
@@ -1361,17 +1664,17 @@ int ubi_thread(void *u)
 		}
 		spin_unlock(&ubi->wl_lock);
 
-		err = do_work(ubi);
+		err = do_work(ubi, which);
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
-				ubi->bgt_name, err);
+				current->comm, err);
 			if (failures++ > WL_MAX_FAILURES) {
 				/*
 				 * Too many failures, disable the thread and
 				 * switch to read-only mode.
 				 */
 				ubi_msg("%s: %d consecutive failures",
-					ubi->bgt_name, WL_MAX_FAILURES);
+					current->comm, WL_MAX_FAILURES);
 				ubi_ro_mode(ubi);
 				ubi->thread_enabled = 0;
 				continue;
@@ -1382,10 +1685,87 @@ int ubi_thread(void *u)
 		cond_resched();
 	}
 
-	dbg_wl("background thread \"%s\" is killed", ubi->bgt_name);
+	dbg_wl("background thread \"%s\" is killed", current->comm);
+}
+
+/**
+ * ubi_thread - UBI background thread.
+ * @u: the UBI device description object pointer
+ */
+int ubi_thread(void *u)
+{
+	thread_loop(u, 0);
+	return 0;
+}
+
+#ifdef UBI_ERASE_THREADS
+/**
+ * ubi_erase_thread - additional UBI background thread which only erases.
+ * @u: the UBI device description object pointer
+ *
+ * Several erasures may be in flight at a time, which helps MTD devices which
+ * can erase on several chips or planes in parallel.
+ */
+static int ubi_erase_thread(void *u)
+{
+	thread_loop(u, 1);
 	return 0;
 }
 
+/**
+ * ubi_wl_start_erase_threads - create the erase threads of an UBI device.
+ * @ubi: UBI device description object
+ *
+ * The threads are created stopped, 'ubi_wl_wake_erase_threads()' starts them
+ * once @ubi->thread_enabled is set.
+ */
+void ubi_wl_start_erase_threads(struct ubi_device *ubi)
+{
+	struct task_struct *t;
+	int i;
+
+	for (i = 0; i < UBI_ERASE_THREADS; i++) {
+		t = kthread_create(ubi_erase_thread, ubi, "%s/%d",
+				   ubi->bgt_name, i + 1);
+		if (IS_ERR(t)) {
+			/* Not fatal, there are just fewer erasures in flight */
+			ubi_warn("cannot spawn erase thread %d, error %d",
+				 i + 1, (int)PTR_ERR(t));
+			break;
+		}
+		ubi->erase_thread[i] = t;
+	}
+}
+
+/**
+ * ubi_wl_wake_erase_threads - wake up the erase threads of an UBI device.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_wake_erase_threads(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < UBI_ERASE_THREADS; i++)
+		if (ubi->erase_thread[i])
+			wake_up_process(ubi->erase_thread[i]);
+}
+
+/**
+ * ubi_wl_stop_erase_threads - stop the erase threads of an UBI device.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_stop_erase_threads(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < UBI_ERASE_THREADS; i++)
+		if (ubi->erase_thread[i]) {
+			kthread_stop(ubi->erase_thread[i]);
+			ubi->erase_thread[i] = NULL;
+		}
+}
+#endif
+
 /**
  * cancel_pending - cancel all pending works.
  * @ubi: UBI device description object
@@ -1464,6 +1844,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		e->ec = seb->ec;
 		ubi_assert(e->ec >= 0);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
 		ubi->lookuptbl[e->pnum] = e;
 	}
 
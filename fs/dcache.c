@@ -38,6 +38,12 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * dcache_lock still serializes every change to the hash chains, the
+ * d_subdirs and i_dentry lists and the LRU: d_alloc, d_instantiate,
+ * d_move, d_delete and pruning all take it.  Only hash lookups (RCU)
+ * and the final dput() of a cached dentry (d_lock) do without it.
+ */
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lock);
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
@@ -124,6 +130,11 @@ static void dentry_iput(struct dentry * dentry)
 
 /*
  * dentry_lru_(add|add_tail|del|del_init) must be called with dcache_lock held.
+ *
+ * dput() drops the final reference to a hashed dentry that is already on
+ * the LRU while holding only dentry->d_lock.  Anybody who takes a dentry
+ * off the LRU because it looks busy must therefore test d_count under
+ * d_lock as well, or that dentry could end up unused and off the LRU.
  */
 static void dentry_lru_add(struct dentry *dentry)
 {
@@ -220,6 +231,24 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (atomic_add_unless(&dentry->d_count, -1, 1))
+		return;
+
+	/*
+	 * Dropping the last reference to a hashed dentry which is already
+	 * on the LRU only needs d_lock: nothing but the count changes, and
+	 * everybody who could kill or unhash it takes d_lock too.  This keeps
+	 * repeated lookups of cached names off dcache_lock.
+	 */
+	spin_lock(&dentry->d_lock);
+	if (!d_unhashed(dentry) && !list_empty(&dentry->d_lru) &&
+	    !(dentry->d_op && dentry->d_op->d_delete) &&
+	    atomic_cmpxchg(&dentry->d_count, 1, 0) == 1) {
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+	spin_unlock(&dentry->d_lock);
+
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -822,15 +851,17 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 
-		dentry_lru_del_init(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
 		 * of the unused list for prune_dcache
 		 */
+		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		if (!atomic_read(&dentry->d_count)) {
 			dentry_lru_add_tail(dentry);
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -1358,17 +1389,39 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 }
 
 struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
+{
+	struct dentry *dentry;
+
+	rcu_read_lock();
+	dentry = __d_lookup_noref(parent, name);
+	if (dentry) {
+		atomic_inc(&dentry->d_count);
+		spin_unlock(&dentry->d_lock);
+	}
+	rcu_read_unlock();
+
+	return dentry;
+}
+
+/**
+ * __d_lookup_noref - search for a dentry without taking a reference
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ *
+ * Like __d_lookup(), but the caller must hold rcu_read_lock() and the
+ * dentry is returned with its d_lock held and no reference taken.  While
+ * d_lock is held the dentry stays hashed and its inode cannot be released.
+ * The caller is responsible for validating against concurrent renames.
+ */
+struct dentry *__d_lookup_noref(struct dentry *parent, struct qstr *name)
 {
 	unsigned int len = name->len;
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
 	struct hlist_head *head = d_hash(parent,hash);
-	struct dentry *found = NULL;
 	struct hlist_node *node;
 	struct dentry *dentry;
 
-	rcu_read_lock();
-	
 	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
 		struct qstr *qstr;
 
@@ -1406,16 +1459,12 @@ struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
 				goto next;
 		}
 
-		atomic_inc(&dentry->d_count);
-		found = dentry;
-		spin_unlock(&dentry->d_lock);
-		break;
+		return dentry;
 next:
 		spin_unlock(&dentry->d_lock);
  	}
- 	rcu_read_unlock();
 
- 	return found;
+ 	return NULL;
 }
 
 /**
@@ -1502,6 +1551,10 @@ out:
  *
  * Turn the dentry into a negative dentry if possible, otherwise
  * remove it from the hash queues so it can be deleted later
+ *
+ * Hashed directories are always unhashed rather than turned negative:
+ * the reference-free path walk relies on a hashed directory dentry
+ * keeping its inode for as long as it stays in the hash.
  */
  
 void d_delete(struct dentry * dentry)
@@ -1513,7 +1566,8 @@ void d_delete(struct dentry * dentry)
 	spin_lock(&dcache_lock);
 	spin_lock(&dentry->d_lock);
 	isdir = S_ISDIR(dentry->d_inode->i_mode);
-	if (atomic_read(&dentry->d_count) == 1) {
+	if (atomic_read(&dentry->d_count) == 1 &&
+	    (!isdir || d_unhashed(dentry))) {
 		dentry_iput(dentry);
 		fsnotify_nameremove(dentry, isdir);
 		return;
@@ -80,6 +80,11 @@ extern void chroot_fs_refs(struct path *, struct path *);
  */
 extern void mark_files_ro(struct super_block *);
 
+/*
+ * inode.c
+ */
+extern int get_nr_dirty_inodes(void);
+
 /*
  * super.c
  */
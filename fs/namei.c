@@ -465,6 +465,32 @@ ok:
 	return security_inode_permission(inode, MAY_EXEC);
 }
 
+static int check_acl_rcu(struct inode *inode, int mask)
+{
+	return -ECHILD;
+}
+
+/*
+ * exec_permission_rcu - exec_permission_lite() under dentry->d_lock
+ *
+ * Used by the reference-free walk, which cannot sleep and has no
+ * reference on the inode.  Anything beyond a plain mode check (->permission,
+ * ACLs, capabilities, security modules) returns an error so that the
+ * ordinary walk redoes the check properly.
+ */
+static int exec_permission_rcu(struct inode *inode)
+{
+	int ret;
+
+	if (inode->i_op->permission)
+		return -ECHILD;
+	ret = acl_permission_check(inode, MAY_EXEC,
+			inode->i_op->check_acl ? check_acl_rcu : NULL);
+	if (ret)
+		return ret;
+	return security_inode_permission_rcu(inode, MAY_EXEC);
+}
+
 /*
  * This is called when everything else fails, and we actually have
  * to go to the low-level filesystem to find out what we should do..
@@ -827,6 +853,121 @@ fail:
 	return PTR_ERR(dentry);
 }
 
+/*
+ * Reference-free walk of the leading directories of a pathname.
+ *
+ * Cached directories are looked up under rcu_read_lock() and checked under
+ * their d_lock, one at a time, without touching their reference counts.
+ * This is not a lock-free walk: every component still takes and drops its
+ * d_lock, it only saves the d_count atomics and the dput() of each step.
+ * We stop in front of anything that needs more care - the last component,
+ * "..", cache misses, symlinks, mountpoints, ->d_hash()/->d_revalidate()
+ * and permission checks that cannot be done under a spinlock - take one
+ * reference on the directory reached, and let __link_path_walk() carry on
+ * from there.  Renames anywhere in the tree invalidate the walk.
+ *
+ * Returns the part of @name still to be walked.  If nothing was walked, or
+ * we raced with a rename, @name is returned and @nd is left untouched.
+ */
+static const char *noref_walk_dirs(const char *name, struct nameidata *nd)
+{
+	struct dentry *start = nd->path.dentry;
+	struct dentry *parent = start;
+	const char *rest = name;
+	const char *p = name;
+	unsigned long seq;
+
+	rcu_read_lock();
+	seq = read_seqbegin(&rename_lock);
+
+	if (exec_permission_rcu(start->d_inode))
+		goto out;
+
+	for (;;) {
+		unsigned long hash;
+		struct qstr this;
+		struct dentry *dentry;
+		struct inode *inode;
+		unsigned int c;
+
+		this.name = p;
+		c = *(const unsigned char *)p;
+
+		hash = init_name_hash();
+		do {
+			p++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)p;
+		} while (c && (c != '/'));
+		this.len = p - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* the last component is always left to the caller */
+		if (!c)
+			break;
+		while (*++p == '/');
+		if (!*p)
+			break;
+
+		if (this.name[0] == '.') {
+			if (this.len == 1) {
+				rest = p;
+				continue;
+			}
+			if (this.len == 2 && this.name[1] == '.')
+				break;
+		}
+		if (parent->d_op && parent->d_op->d_hash)
+			break;
+
+		dentry = __d_lookup_noref(parent, &this);
+		if (!dentry)
+			break;
+		inode = dentry->d_inode;
+		if (!inode || !inode->i_op->lookup ||
+		    inode->i_op->follow_link || d_mountpoint(dentry) ||
+		    (dentry->d_op && dentry->d_op->d_revalidate) ||
+		    exec_permission_rcu(inode)) {
+			spin_unlock(&dentry->d_lock);
+			break;
+		}
+		spin_unlock(&dentry->d_lock);
+
+		parent = dentry;
+		rest = p;
+	}
+
+	if (parent != start) {
+		/*
+		 * A hashed directory dentry never loses its inode (see
+		 * d_delete()), so if it is still hashed and nothing was
+		 * renamed, the inodes we checked are the ones on the path.
+		 */
+		spin_lock(&parent->d_lock);
+		if (d_unhashed(parent) || !parent->d_inode) {
+			spin_unlock(&parent->d_lock);
+			parent = start;
+			rest = name;
+			goto out;
+		}
+		dget_dlock(parent);
+		spin_unlock(&parent->d_lock);
+
+		if (read_seqretry(&rename_lock, seq)) {
+			rcu_read_unlock();
+			dput(parent);
+			return name;
+		}
+	}
+out:
+	rcu_read_unlock();
+	if (parent != start) {
+		nd->path.dentry = parent;
+		dput(start);
+	}
+	return rest;
+}
+
 /*
  * Name resolution.
  * This is the basic name resolution function, turning a pathname into
@@ -847,6 +988,9 @@ static int __link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		goto return_reval;
 
+	if (!(nd->flags & LOOKUP_REVAL))
+		name = noref_walk_dirs(name, nd);
+
 	inode = nd->path.dentry->d_inode;
 	if (nd->depth)
 		lookup_flags = LOOKUP_FOLLOW | (nd->flags & LOOKUP_CONTINUE);
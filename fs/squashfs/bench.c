@@ -0,0 +1,172 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Times cold reads of a list of files, e.g. everything an application
+ * maps at startup, to compare decompressors on the same image:
+ *
+ *   mksquashfs root root-zlib.img
+ *   mksquashfs root root-lzo.img -comp lzo
+ *   mount -o loop root-lzo.img /mnt
+ *   modprobe squashfs_bench files=/mnt/usr/bin/app,/mnt/usr/lib/libapp.so
+ *
+ * The page cache of every file is dropped before each run, the squashfs
+ * metadata and fragment caches are not.  The module never stays loaded,
+ * it returns -EAGAIN once the report is done.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * bench.c
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/hrtimer.h>
+#include <linux/magic.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "decompressor.h"
+
+#define BENCH_MAX_FILES	64
+#define BENCH_BUF_SIZE	(64 * 1024)
+
+static char *files;
+module_param(files, charp, 0);
+MODULE_PARM_DESC(files, "Comma separated list of files on a squashfs mount");
+
+static unsigned int runs = 3;
+module_param(runs, uint, 0);
+MODULE_PARM_DESC(runs, "Number of timed runs");
+
+static struct file *filp[BENCH_MAX_FILES];
+static int nr_files;
+
+static int bench_open(char *list)
+{
+	char *name;
+	struct file *f;
+
+	while ((name = strsep(&list, ",")) != NULL) {
+		if (!*name)
+			continue;
+		if (nr_files == BENCH_MAX_FILES) {
+			printk(KERN_ERR "squashfs_bench: too many files\n");
+			return -E2BIG;
+		}
+
+		f = filp_open(name, O_RDONLY | O_LARGEFILE, 0);
+		if (IS_ERR(f)) {
+			printk(KERN_ERR "squashfs_bench: can't open %s\n",
+				name);
+			return PTR_ERR(f);
+		}
+		filp[nr_files++] = f;
+
+		if (f->f_path.dentry->d_sb->s_magic != SQUASHFS_MAGIC ||
+				!S_ISREG(f->f_path.dentry->d_inode->i_mode)) {
+			printk(KERN_ERR "squashfs_bench: %s is not a regular "
+				"file on squashfs\n", name);
+			return -EINVAL;
+		}
+	}
+
+	return nr_files ? 0 : -EINVAL;
+}
+
+static int bench_run(char *buf, u64 *bytes)
+{
+	loff_t pos;
+	int i, res;
+
+	for (i = 0; i < nr_files; i++)
+		invalidate_mapping_pages(filp[i]->f_mapping, 0, -1);
+
+	*bytes = 0;
+	for (i = 0; i < nr_files; i++) {
+		pos = 0;
+		while ((res = kernel_read(filp[i], pos, buf,
+				BENCH_BUF_SIZE)) > 0) {
+			pos += res;
+			*bytes += res;
+		}
+		if (res < 0)
+			return res;
+	}
+
+	return 0;
+}
+
+static int __init squashfs_bench_init(void)
+{
+	struct squashfs_sb_info *msblk;
+	char *list = NULL, *buf = NULL;
+	ktime_t start;
+	s64 us;
+	u64 bytes;
+	unsigned int run;
+	int i, res = -ENOMEM;
+
+	if (files == NULL || !runs)
+		return -EINVAL;
+
+	list = kstrdup(files, GFP_KERNEL);
+	buf = kmalloc(BENCH_BUF_SIZE, GFP_KERNEL);
+	if (list == NULL || buf == NULL)
+		goto out;
+
+	res = bench_open(list);
+	if (res)
+		goto out;
+
+	msblk = filp[0]->f_path.dentry->d_sb->s_fs_info;
+	for (run = 0; run < runs; run++) {
+		start = ktime_get();
+		res = bench_run(buf, &bytes);
+		if (res) {
+			printk(KERN_ERR "squashfs_bench: read error %d\n",
+				res);
+			goto out;
+		}
+		us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+		printk(KERN_INFO "squashfs_bench: %s, block %u: %d files, "
+			"%llu KiB in %lld us\n", msblk->decompressor->name,
+			msblk->block_size, nr_files,
+			(unsigned long long) bytes >> 10, (long long) us);
+	}
+
+	res = -EAGAIN;
+
+out:
+	for (i = 0; i < nr_files; i++)
+		fput(filp[i]);
+	kfree(buf);
+	kfree(list);
+	return res;
+}
+
+static void __exit squashfs_bench_exit(void) { }
+
+module_init(squashfs_bench_init);
+module_exit(squashfs_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Squashfs cold read benchmark");
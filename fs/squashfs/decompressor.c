@@ -0,0 +1,189 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor.c
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+#include "page_actor.h"
+
+/*
+ * This file (and decompressor.h) implements a decompressor framework for
+ * Squashfs, allowing multiple decompressors to be easily supported
+ */
+
+#ifndef CONFIG_SQUASHFS_LZMA
+static const struct squashfs_decompressor squashfs_lzma_unsupported_comp_ops = {
+	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
+};
+#endif
+
+#ifndef CONFIG_SQUASHFS_LZO
+static const struct squashfs_decompressor squashfs_lzo_unsupported_comp_ops = {
+	NULL, NULL, NULL, LZO_COMPRESSION, "lzo", 0
+};
+#endif
+
+static const struct squashfs_decompressor squashfs_xz_unsupported_comp_ops = {
+	NULL, NULL, NULL, XZ_COMPRESSION, "xz", 0
+};
+
+static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
+	NULL, NULL, NULL, 0, "unknown", 0
+};
+
+static const struct squashfs_decompressor *decompressor[] = {
+	&squashfs_zlib_comp_ops,
+#ifdef CONFIG_SQUASHFS_LZMA
+	&squashfs_lzma_comp_ops,
+#else
+	&squashfs_lzma_unsupported_comp_ops,
+#endif
+#ifdef CONFIG_SQUASHFS_LZO
+	&squashfs_lzo_comp_ops,
+#else
+	&squashfs_lzo_unsupported_comp_ops,
+#endif
+	&squashfs_xz_unsupported_comp_ops,
+	&squashfs_unknown_comp_ops
+};
+
+
+const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
+{
+	int i;
+
+	for (i = 0; decompressor[i]->id; i++)
+		if (id == decompressor[i]->id)
+			break;
+
+	return decompressor[i];
+}
+
+
+/*
+ * Each possible CPU gets its own decompressor state, so readers running
+ * on different CPUs decompress in parallel rather than queueing behind a
+ * single stream.  The state is picked by the CPU the reader happens to be
+ * on and held under a mutex, as backends such as lzma sleep.  Two readers
+ * only ever contend when they are on the same CPU.
+ */
+int squashfs_decompressor_init(struct squashfs_sb_info *msblk)
+{
+	int cpu;
+
+	msblk->stream = alloc_percpu(struct squashfs_stream);
+	if (msblk->stream == NULL)
+		goto failed;
+
+	for_each_possible_cpu(cpu) {
+		struct squashfs_stream *stream = per_cpu_ptr(msblk->stream,
+			cpu);
+
+		mutex_init(&stream->mutex);
+		stream->stream = msblk->decompressor->init(msblk);
+		if (stream->stream == NULL)
+			goto failed;
+	}
+
+	return 0;
+
+failed:
+	ERROR("Failed to allocate %s decompressor\n",
+		msblk->decompressor->name);
+	squashfs_decompressor_free(msblk);
+	return -ENOMEM;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk)
+{
+	int cpu;
+
+	if (msblk->stream == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		void *stream = per_cpu_ptr(msblk->stream, cpu)->stream;
+
+		if (stream)
+			msblk->decompressor->free(stream);
+	}
+	free_percpu(msblk->stream);
+	msblk->stream = NULL;
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_stream *stream = per_cpu_ptr(msblk->stream,
+		raw_smp_processor_id());
+	int res;
+
+	mutex_lock(&stream->mutex);
+	res = msblk->decompressor->decompress(msblk, stream->stream, output,
+		bh, b, offset, length, srclength);
+	mutex_unlock(&stream->mutex);
+
+	return res;
+}
+
+
+/*
+ * Helpers for backends that can't stream, gather the compressed block
+ * into one buffer and scatter the result into the output pages.
+ */
+void squashfs_copy_in(struct squashfs_sb_info *msblk, void *dest,
+	struct buffer_head **bh, int b, int offset, int length)
+{
+	int i, avail;
+
+	for (i = 0; i < b && length; i++) {
+		avail = min(length, msblk->devblksize - offset);
+		memcpy(dest, bh[i]->b_data + offset, avail);
+		dest += avail;
+		length -= avail;
+		offset = 0;
+	}
+}
+
+
+void squashfs_copy_out(struct squashfs_page_actor *output, void *src,
+	int length)
+{
+	void *data = squashfs_first_page(output);
+	int avail;
+
+	for (; data && length; data = squashfs_next_page(output)) {
+		avail = min_t(int, length, PAGE_CACHE_SIZE);
+		memcpy(data, src, avail);
+		src += avail;
+		length -= avail;
+	}
+	squashfs_finish_page(output);
+}
@@ -53,6 +53,7 @@
 #include "squashfs_fs_sb.h"
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * Locate cache slot in range [offset, index] for specified inode.  If
@@ -372,6 +373,74 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages it covers,
+ * avoiding the intermediate read_page cache entry and the copy out of it.
+ * This only works if every page can be grabbed and none is uptodate yet,
+ * otherwise -EAGAIN is returned and the caller goes through the cache.
+ * The decompressor maps the pages one at a time as it fills them.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize, int start_index, int end_index)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int i, n, pages, avail, res = -EAGAIN;
+	struct squashfs_page_actor actor;
+	struct page **page;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kcalloc(pages, sizeof(*page), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+
+	for (i = 0, n = start_index; i < pages; i++, n++) {
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+		if (page[i] == NULL || (page[i] != target_page &&
+						PageUptodate(page[i])))
+			goto release_pages;
+	}
+
+	squashfs_actor_init_page(&actor, page, pages);
+	res = squashfs_read_data(inode->i_sb, &actor, block, bsize, NULL,
+		msblk->block_size);
+
+	for (i = 0; res >= 0 && i < pages; i++) {
+		avail = min_t(int, max(res - i * (int) PAGE_CACHE_SIZE, 0),
+			PAGE_CACHE_SIZE);
+		if (avail < PAGE_CACHE_SIZE)
+			zero_user_segment(page[i], avail, PAGE_CACHE_SIZE);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+
+	if (res == -ENOMEM)
+		/* the read cache has its buffers already, let it try */
+		res = -EAGAIN;
+	else if (res < 0)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+	else {
+		unlock_page(target_page);
+		res = 0;
+	}
+
+release_pages:
+	for (i = 0; i < pages && page[i]; i++)
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -411,8 +480,16 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock, directly into the
+			 * page cache if possible.
 			 */
+			int res = squashfs_readpage_block(page, block, bsize,
+				start_index, end_index);
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
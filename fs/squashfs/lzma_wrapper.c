@@ -0,0 +1,145 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * lzma_wrapper.c
+ */
+
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/decompress/unlzma.h>
+#include <asm/unaligned.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "decompressor.h"
+
+/*
+ * Blocks are stored in the lzma "alone" format: a properties byte, the
+ * 32-bit dictionary size and the 64-bit uncompressed size, followed by
+ * the compressed data.
+ */
+#define LZMA_HEADER_SIZE	13
+#define LZMA_PROPS_MAX		(9 * 5 * 5)
+
+/*
+ * The probability table is kept with the stream for lc + lp up to this,
+ * which covers the lc=3 lp=0 mksquashfs uses.  Blocks with more literal
+ * context bits still work, unlzma() then allocates a table for each.
+ */
+#define LZMA_LCLP_MAX		4
+#define LZMA_NR_PROBS		UNLZMA_PROBS(LZMA_LCLP_MAX)
+
+/*
+ * unlzma() uses its output buffer as the dictionary, so it has to be
+ * flat, and it wants its input in one piece as well.
+ */
+struct squashfs_lzma {
+	void	*input;
+	void	*output;
+	u16	*probs;
+};
+
+static void lzma_free(void *strm)
+{
+	struct squashfs_lzma *stream = strm;
+
+	if (stream) {
+		vfree(stream->input);
+		vfree(stream->output);
+		vfree(stream->probs);
+	}
+	kfree(stream);
+}
+
+
+static void *lzma_init(struct squashfs_sb_info *msblk)
+{
+	int block_size = max_t(int, msblk->block_size, SQUASHFS_METADATA_SIZE);
+	struct squashfs_lzma *stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+
+	if (stream == NULL)
+		goto failed;
+	stream->input = vmalloc(block_size);
+	if (stream->input == NULL)
+		goto failed;
+	stream->output = vmalloc(block_size);
+	if (stream->output == NULL)
+		goto failed;
+	stream->probs = vmalloc(LZMA_NR_PROBS * sizeof(*stream->probs));
+	if (stream->probs == NULL)
+		goto failed;
+
+	return stream;
+
+failed:
+	ERROR("Failed to allocate lzma workspace\n");
+	lzma_free(stream);
+	return NULL;
+}
+
+
+static void lzma_error(char *m)
+{
+	ERROR("unlzma error: %s\n", m);
+}
+
+
+static int lzma_uncompress(struct squashfs_sb_info *msblk, void *strm,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_lzma *stream = strm;
+	unsigned char *input = stream->input;
+	u64 uncompressed_size;
+
+	if (length < LZMA_HEADER_SIZE)
+		goto failed;
+
+	squashfs_copy_in(msblk, input, bh, b, offset, length);
+
+	/*
+	 * unlzma() trusts the header and writes as many bytes as it
+	 * claims, so check it against the output buffer first.
+	 */
+	uncompressed_size = get_unaligned_le64(input + 5);
+	if (input[0] >= LZMA_PROPS_MAX || uncompressed_size > srclength)
+		goto failed;
+
+	if (unlzma_probs(input, length, NULL, NULL, stream->output, NULL,
+			lzma_error, stream->probs, LZMA_NR_PROBS))
+		goto failed;
+
+	squashfs_copy_out(output, stream->output, uncompressed_size);
+	return uncompressed_size;
+
+failed:
+	ERROR("lzma decompression failed, data probably corrupt\n");
+	return -EIO;
+}
+
+const struct squashfs_decompressor squashfs_lzma_comp_ops = {
+	.init = lzma_init,
+	.free = lzma_free,
+	.decompress = lzma_uncompress,
+	.id = LZMA_COMPRESSION,
+	.name = "lzma",
+	.supported = 1
+};
@@ -0,0 +1,85 @@
+#ifndef PAGE_ACTOR_H
+#define PAGE_ACTOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * page_actor.h
+ */
+
+#include <linux/highmem.h>
+
+/*
+ * The output of squashfs_read_data(), handed out to the decompressors one
+ * PAGE_CACHE_SIZE buffer at a time.  It is either a set of buffers that are
+ * always mapped (cache entries, tables) or a set of page cache pages, of
+ * which only the one being written is kmapped.
+ */
+struct squashfs_page_actor {
+	void		**buffer;
+	struct page	**page;
+	void		*pageaddr;
+	int		pages;
+	int		next_page;
+};
+
+static inline void squashfs_actor_init(struct squashfs_page_actor *actor,
+	void **buffer, int pages)
+{
+	actor->buffer = buffer;
+	actor->page = NULL;
+	actor->pageaddr = NULL;
+	actor->pages = pages;
+	actor->next_page = 0;
+}
+
+static inline void squashfs_actor_init_page(struct squashfs_page_actor *actor,
+	struct page **page, int pages)
+{
+	squashfs_actor_init(actor, NULL, pages);
+	actor->page = page;
+}
+
+static inline void squashfs_finish_page(struct squashfs_page_actor *actor)
+{
+	if (actor->pageaddr) {
+		kunmap(actor->page[actor->next_page - 1]);
+		actor->pageaddr = NULL;
+	}
+}
+
+/* Returns the next output buffer, or NULL once they are all used up */
+static inline void *squashfs_next_page(struct squashfs_page_actor *actor)
+{
+	squashfs_finish_page(actor);
+
+	if (actor->next_page == actor->pages)
+		return NULL;
+
+	if (actor->page == NULL)
+		return actor->buffer[actor->next_page++];
+
+	actor->pageaddr = kmap(actor->page[actor->next_page++]);
+	return actor->pageaddr;
+}
+
+static inline void *squashfs_first_page(struct squashfs_page_actor *actor)
+{
+	squashfs_finish_page(actor);
+	actor->next_page = 0;
+	return squashfs_next_page(actor);
+}
+#endif
@@ -25,9 +25,20 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * Every compressor has one cryptoapi handle allocated at init time, and
+ * each CPU gets a handle of its own the first time it compresses or
+ * decompresses data with that compressor. A zlib handle carries a few
+ * hundred KiB of vmalloc'ed workspace, so a file-system which only uses LZO
+ * never pays that for every CPU. Until a CPU has its own handle, or if
+ * allocating it fails, the shared handle is used as before.
+ *
+ * Callers may sleep and migrate while they use a handle, which is why even
+ * the per-CPU handles are protected by mutexes.
  */
 
 #include <linux/crypto.h>
+#include <linux/percpu.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -38,11 +49,9 @@ static struct ubifs_compressor none_compr = {
 };
 
 #ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
-
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
+	.comp_lock = 1,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -54,13 +63,10 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
+	.comp_lock = 1,
+	.decomp_lock = 1,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -74,6 +80,42 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/**
+ * get_ctx - get the compressor context for the current CPU.
+ * @compr: compressor description object
+ *
+ * This function returns the context of the CPU the caller runs on,
+ * allocating its cryptoapi handle if this is the first use. If the handle
+ * cannot be allocated, or somebody else is allocating one right now (which
+ * includes memory reclaim having recursed into UBIFS from the allocation),
+ * the shared fallback context is returned instead.
+ */
+static struct ubifs_compr_ctx *get_ctx(struct ubifs_compressor *compr)
+{
+	struct ubifs_compr_ctx *ctx;
+	struct crypto_comp *cc;
+
+	ctx = per_cpu_ptr(compr->ctx, raw_smp_processor_id());
+	if (likely(ctx->cc))
+		return ctx;
+
+	if (!mutex_trylock(&compr->ctx_mutex))
+		return &compr->fallback;
+
+	if (!ctx->cc) {
+		cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(cc)) {
+			mutex_unlock(&compr->ctx_mutex);
+			return &compr->fallback;
+		}
+		/* Other CPUs look at @ctx->cc without the mutex */
+		smp_wmb();
+		ctx->cc = cc;
+	}
+	mutex_unlock(&compr->ctx_mutex);
+	return ctx;
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -97,6 +139,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct ubifs_compr_ctx *ctx;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +148,13 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	ctx = get_ctx(compr);
+	if (compr->comp_lock)
+		mutex_lock(&ctx->comp_mutex);
+	err = crypto_comp_compress(ctx->cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	if (compr->comp_lock)
+		mutex_unlock(&ctx->comp_mutex);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -150,6 +194,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 {
 	int err;
 	struct ubifs_compressor *compr;
+	struct ubifs_compr_ctx *ctx;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +214,13 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
+	ctx = get_ctx(compr);
+	if (compr->decomp_lock)
+		mutex_lock(&ctx->decomp_mutex);
+	err = crypto_comp_decompress(ctx->cc, in_buf, in_len, out_buf,
 				     (unsigned int *)out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	if (compr->decomp_lock)
+		mutex_unlock(&ctx->decomp_mutex);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -182,6 +228,35 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	return err;
 }
 
+/**
+ * init_ctx - initialize a compressor context.
+ * @ctx: the context to initialize
+ */
+static void init_ctx(struct ubifs_compr_ctx *ctx)
+{
+	mutex_init(&ctx->comp_mutex);
+	mutex_init(&ctx->decomp_mutex);
+}
+
+/**
+ * free_ctxs - free compressor contexts.
+ * @compr: compressor description object
+ */
+static void free_ctxs(struct ubifs_compressor *compr)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ubifs_compr_ctx *ctx = per_cpu_ptr(compr->ctx, cpu);
+
+		if (ctx->cc)
+			crypto_free_comp(ctx->cc);
+	}
+	free_percpu(compr->ctx);
+	compr->ctx = NULL;
+	crypto_free_comp(compr->fallback.cc);
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
@@ -191,13 +266,26 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
  */
 static int __init compr_init(struct ubifs_compressor *compr)
 {
+	int cpu;
+
 	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
+		compr->fallback.cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(compr->fallback.cc)) {
 			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+				  compr->name, PTR_ERR(compr->fallback.cc));
+			return PTR_ERR(compr->fallback.cc);
+		}
+		init_ctx(&compr->fallback);
+		mutex_init(&compr->ctx_mutex);
+
+		/* The per-CPU handles are only allocated when needed */
+		compr->ctx = alloc_percpu(struct ubifs_compr_ctx);
+		if (!compr->ctx) {
+			crypto_free_comp(compr->fallback.cc);
+			return -ENOMEM;
 		}
+		for_each_possible_cpu(cpu)
+			init_ctx(per_cpu_ptr(compr->ctx, cpu));
 	}
 
 	ubifs_compressors[compr->compr_type] = compr;
@@ -211,7 +299,7 @@ static int __init compr_init(struct ubifs_compressor *compr)
 static void compr_exit(struct ubifs_compressor *compr)
 {
 	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
+		free_ctxs(compr);
 	return;
 }
 
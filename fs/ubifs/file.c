@@ -52,6 +52,7 @@
 #include "ubifs.h"
 #include <linux/mount.h>
 #include <linux/namei.h>
+#include <linux/cpu.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -696,6 +697,107 @@ out_err:
 	return -EINVAL;
 }
 
+/**
+ * populate_pages_range - populate consecutive pages for bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @pages: locked pages to populate
+ * @cnt: how many pages there are in @pages
+ *
+ * This function populates @pages, then unlocks and releases them. A page which
+ * fails is left with the error flag set.
+ */
+static void populate_pages_range(struct ubifs_info *c, struct bu_info *bu,
+				 struct page **pages, int cnt)
+{
+	int i, n = 0;
+
+	for (i = 0; i < cnt; i++) {
+		populate_page(c, pages[i], bu, &n);
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+}
+
+/**
+ * struct bu_work - part of a bulk-read populated by another CPU.
+ * @work: the work, queued to @ubifs_bu_wq
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @pages: locked pages to populate
+ * @cnt: how many pages there are in @pages
+ */
+struct bu_work {
+	struct work_struct work;
+	struct ubifs_info *c;
+	struct bu_info *bu;
+	struct page **pages;
+	int cnt;
+};
+
+static void bu_work_fn(struct work_struct *work)
+{
+	struct bu_work *w = container_of(work, struct bu_work, work);
+
+	populate_pages_range(w->c, w->bu, w->pages, w->cnt);
+}
+
+/**
+ * populate_pages - populate pages for bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @pages: locked pages to populate
+ * @cnt: how many pages there are in @pages
+ *
+ * Decompressing the data nodes is what a bulk-read spends most of its time on,
+ * and the nodes are independent of each other. So if there are enough pages
+ * and other CPUs are online, @pages are split in ranges of at least
+ * %UBIFS_BU_CPU_PAGES pages, and all ranges but the first are populated by
+ * @ubifs_bu_wq on other CPUs while this CPU populates the first one. Each CPU
+ * decompresses using its own compressor context. The pages are unlocked and
+ * released once populated.
+ */
+static void populate_pages(struct ubifs_info *c, struct bu_info *bu,
+			   struct page **pages, int cnt)
+{
+	struct bu_work *works = NULL;
+	int i, nr, cpu;
+
+	get_online_cpus();
+	nr = min_t(int, num_online_cpus(), cnt / UBIFS_BU_CPU_PAGES);
+	if (nr > 1 && ubifs_bu_wq)
+		works = kmalloc((nr - 1) * sizeof(struct bu_work),
+				GFP_NOFS | __GFP_NOWARN);
+	if (!works) {
+		put_online_cpus();
+		populate_pages_range(c, bu, pages, cnt);
+		return;
+	}
+
+	cpu = raw_smp_processor_id();
+	for (i = 1; i < nr; i++) {
+		struct bu_work *w = &works[i - 1];
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+
+		INIT_WORK(&w->work, bu_work_fn);
+		w->c = c;
+		w->bu = bu;
+		w->pages = pages + i * cnt / nr;
+		w->cnt = (i + 1) * cnt / nr - i * cnt / nr;
+		queue_work_on(cpu, ubifs_bu_wq, &w->work);
+	}
+
+	populate_pages_range(c, bu, pages, cnt / nr);
+
+	for (i = 1; i < nr; i++)
+		flush_work(&works[i - 1].work);
+	put_online_cpus();
+	kfree(works);
+}
+
 /**
  * ubifs_do_bulk_read - do bulk-read.
  * @c: UBIFS file-system description object
@@ -711,7 +813,8 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	struct address_space *mapping = page1->mapping;
 	struct inode *inode = mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
-	int err, page_idx, page_cnt, ret = 0, n = 0;
+	struct page *pages[UBIFS_MAX_BULK_READ];
+	int err, page_idx, page_cnt, ret = 0, n = 0, cnt = 0;
 	int allocate = bu->buf ? 0 : 1;
 	loff_t isize;
 
@@ -779,14 +882,15 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 					   GFP_NOFS | __GFP_COLD);
 		if (!page)
 			break;
-		if (!PageUptodate(page))
-			err = populate_page(c, page, bu, &n);
-		unlock_page(page);
-		page_cache_release(page);
-		if (err)
-			break;
+		if (PageUptodate(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			continue;
+		}
+		pages[cnt++] = page;
 	}
 
+	populate_pages(c, bu, pages, cnt);
 	ui->last_page_read = offset + page_idx - 1;
 
 out_free:
@@ -887,6 +991,40 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
+/**
+ * finish_writepage - finish writing a page back.
+ * @c: UBIFS file-system description object
+ * @page: the page, locked and under write-back
+ * @err: the result of writing the page
+ *
+ * This function releases the budget of the page, unlocks it and ends its
+ * write-back.
+ */
+static void finish_writepage(struct ubifs_info *c, struct page *page, int err)
+{
+	struct inode *inode = page->mapping->host;
+
+	if (err) {
+		SetPageError(page);
+		ubifs_err("cannot write page %lu of inode %lu, error %d",
+			  page->index, inode->i_ino, err);
+		ubifs_ro_mode(c, err);
+	}
+
+	ubifs_assert(PagePrivate(page));
+	if (PageChecked(page))
+		release_new_page_budget(c);
+	else
+		release_existing_page_budget(c);
+
+	atomic_long_dec(&c->dirty_pg_cnt);
+	ClearPagePrivate(page);
+	ClearPageChecked(page);
+
+	unlock_page(page);
+	end_page_writeback(page);
+}
+
 static int do_writepage(struct page *page, int len)
 {
 	int err = 0, i, blen;
@@ -920,26 +1058,9 @@ static int do_writepage(struct page *page, int len)
 		addr += blen;
 		len -= blen;
 	}
-	if (err) {
-		SetPageError(page);
-		ubifs_err("cannot write page %lu of inode %lu, error %d",
-			  page->index, inode->i_ino, err);
-		ubifs_ro_mode(c, err);
-	}
-
-	ubifs_assert(PagePrivate(page));
-	if (PageChecked(page))
-		release_new_page_budget(c);
-	else
-		release_existing_page_budget(c);
-
-	atomic_long_dec(&c->dirty_pg_cnt);
-	ClearPagePrivate(page);
-	ClearPageChecked(page);
 
 	kunmap(page);
-	unlock_page(page);
-	end_page_writeback(page);
+	finish_writepage(c, page, err);
 	return err;
 }
 
@@ -984,8 +1105,25 @@ static int do_writepage(struct page *page, int len)
  * A: If we are in the middle of 'do_writepage()', truncation would be locked
  * on the page lock and it would not write the truncated inode node to the
  * journal before we have finished.
+ *
+ * 'ubifs_writepages()' does the same checks for every page by means of
+ * 'prepare_writepage()', but keeps consecutive pages locked and writes them
+ * together with 'ubifs_jnl_write_pages()'. The pages are still within the
+ * synchronized inode size by the time they are written, and truncation still
+ * waits for them on the page lock.
  */
-static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+
+/**
+ * prepare_writepage - check whether and how much of a page to write back.
+ * @page: the page, locked
+ * @plen: how many bytes of the page have to be written is returned here
+ *
+ * This function makes sure the on-flash inode size covers the page, as
+ * described above. Returns %1 if @plen bytes of the page have to be written,
+ * %0 if there is nothing to write, and a negative error code in case of
+ * failure. In the latter two cases the page has been unlocked.
+ */
+static int prepare_writepage(struct page *page, int *plen)
 {
 	struct inode *inode = page->mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
@@ -1023,7 +1161,8 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			 * with this.
 			 */
 		}
-		return do_writepage(page, PAGE_CACHE_SIZE);
+		*plen = PAGE_CACHE_SIZE;
+		return 1;
 	}
 
 	/*
@@ -1044,13 +1183,115 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			goto out_unlock;
 	}
 
-	return do_writepage(page, len);
+	*plen = len;
+	return 1;
 
 out_unlock:
 	unlock_page(page);
 	return err;
 }
 
+static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+{
+	int err, len;
+
+	err = prepare_writepage(page, &len);
+	if (err <= 0)
+		return err;
+	return do_writepage(page, len);
+}
+
+/**
+ * struct wb_batch - pages collected by 'ubifs_writepages()'.
+ * @pages: consecutive pages, locked and under write-back
+ * @cnt: how many pages there are in @pages
+ * @len: how many bytes of the last page have to be written
+ */
+struct wb_batch {
+	struct page *pages[UBIFS_WB_PAGES];
+	int cnt;
+	int len;
+};
+
+/**
+ * write_batch - write back a batch of pages.
+ * @c: UBIFS file-system description object
+ * @b: the batch
+ *
+ * This function writes all pages of @b to the journal and empties @b. Returns
+ * zero in case of success and a negative error code in case of failure.
+ */
+static int write_batch(struct ubifs_info *c, struct wb_batch *b)
+{
+	struct inode *inode;
+	int err, i;
+
+	if (!b->cnt)
+		return 0;
+
+	inode = b->pages[0]->mapping->host;
+	err = ubifs_jnl_write_pages(c, inode, b->pages, b->cnt, b->len);
+	for (i = 0; i < b->cnt; i++)
+		finish_writepage(c, b->pages[i], err);
+	b->cnt = 0;
+	return err;
+}
+
+static int writepages_cb(struct page *page, struct writeback_control *wbc,
+			 void *data)
+{
+	struct ubifs_info *c = page->mapping->host->i_sb->s_fs_info;
+	struct wb_batch *b = data;
+	int err = 0, ret, len;
+
+	/* Only consecutive pages go to one batch */
+	if (b->cnt && page->index != b->pages[b->cnt - 1]->index + 1)
+		err = write_batch(c, b);
+
+	ret = prepare_writepage(page, &len);
+	if (ret <= 0)
+		return err ? err : ret;
+
+	dbg_gen("ino %lu, pg %lu, batch of %d", page->mapping->host->i_ino,
+		page->index, b->cnt + 1);
+
+	/* Update radix tree tags */
+	set_page_writeback(page);
+	b->pages[b->cnt++] = page;
+	b->len = len;
+
+	if (b->cnt == UBIFS_WB_PAGES || len != PAGE_CACHE_SIZE) {
+		ret = write_batch(c, b);
+		if (!err)
+			err = ret;
+	}
+	return err;
+}
+
+/*
+ * Write-back of many pages. Each data block would otherwise take the journal
+ * head and the commit lock on its own, and UBIFS would compress each page
+ * between two cycles of these locks. Instead, up to %UBIFS_WB_PAGES
+ * consecutive dirty pages are collected and written with
+ * 'ubifs_jnl_write_pages()', which compresses them all first. Page reclaim
+ * still goes through 'ubifs_writepage()'.
+ */
+static int ubifs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
+{
+	struct ubifs_info *c = mapping->host->i_sb->s_fs_info;
+	struct wb_batch b;
+	int err, err1;
+
+	if (UBIFS_WB_PAGES < 2 || !c->wb_buf)
+		return generic_writepages(mapping, wbc);
+
+	b.cnt = 0;
+	err = write_cache_pages(mapping, wbc, writepages_cb, &b);
+	err1 = write_batch(c, &b);
+	return err ? err : err1;
+}
+
 /**
  * do_attr_changes - change inode attributes.
  * @inode: inode to change attributes for
@@ -1554,6 +1795,7 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 const struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
 	.writepage      = ubifs_writepage,
+	.writepages     = ubifs_writepages,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
 	.invalidatepage = ubifs_invalidatepage,
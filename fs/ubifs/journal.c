@@ -748,6 +748,164 @@ out_free:
 	return err;
 }
 
+/**
+ * write_pages_slow - write the data nodes of pages one by one.
+ * @c: UBIFS file-system description object
+ * @inode: inode the pages belong to
+ * @pages: consecutive pages to write
+ * @cnt: how many pages there are in @pages
+ * @len: how many bytes of the last page have to be written
+ *
+ * This is the fall-back of 'ubifs_jnl_write_pages()' for when the write-back
+ * buffer is not available.
+ */
+static int write_pages_slow(struct ubifs_info *c, const struct inode *inode,
+			    struct page **pages, int cnt, int len)
+{
+	int err = 0, i, j, blen, plen;
+	unsigned int block;
+	union ubifs_key key;
+	void *addr;
+
+	for (i = 0; i < cnt && !err; i++) {
+		plen = i == cnt - 1 ? len : PAGE_CACHE_SIZE;
+		block = pages[i]->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+		addr = kmap(pages[i]);
+		for (j = 0; j < plen; j += blen) {
+			blen = min_t(int, plen - j, UBIFS_BLOCK_SIZE);
+			data_key_init(c, &key, inode->i_ino, block++);
+			err = ubifs_jnl_write_data(c, inode, &key, addr + j,
+						   blen);
+			if (err)
+				break;
+		}
+		kunmap(pages[i]);
+	}
+
+	return err;
+}
+
+/**
+ * ubifs_jnl_write_pages - write the data nodes of several pages to the journal.
+ * @c: UBIFS file-system description object
+ * @inode: inode the pages belong to
+ * @pages: consecutive pages to write
+ * @cnt: how many pages there are in @pages (at most %UBIFS_WB_PAGES)
+ * @len: how many bytes of the last page have to be written
+ *
+ * This function does the same as 'ubifs_jnl_write_data()' called for every
+ * data block of @pages, but first compresses all the blocks without holding
+ * any journal lock, and then writes as many data nodes as fit into the data
+ * head LEB with one reservation. All pages except the last one are written
+ * in full. Returns %0 if the data nodes were successfully written, and a
+ * negative error code in case of failure.
+ */
+int ubifs_jnl_write_pages(struct ubifs_info *c, const struct inode *inode,
+			  struct page **pages, int cnt, int len)
+{
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_wbuf *wbuf = &c->jheads[DATAHD].wbuf;
+	struct ubifs_data_node *data;
+	int err, i, j, n = 0, blen, plen, compr_type, out_len, pos = 0;
+	int first, wlen, avail, lnum, offs, dlen[UBIFS_WB_BLOCKS];
+	unsigned int block = pages[0]->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+	union ubifs_key key;
+	void *addr;
+
+	dbg_jnl("ino %lu, pg %lu, %d pages, last len %d", inode->i_ino,
+		pages[0]->index, cnt, len);
+	ubifs_assert(cnt > 0 && cnt <= UBIFS_WB_PAGES);
+	ubifs_assert(len > 0 && len <= PAGE_CACHE_SIZE);
+
+	if (!c->wb_buf || !mutex_trylock(&c->wb_mutex))
+		return write_pages_slow(c, inode, pages, cnt, len);
+
+	for (i = 0; i < cnt; i++) {
+		ubifs_assert(pages[i]->index == pages[0]->index + i);
+		plen = i == cnt - 1 ? len : PAGE_CACHE_SIZE;
+		addr = kmap(pages[i]);
+		for (j = 0; j < plen; j += blen) {
+			blen = min_t(int, plen - j, UBIFS_BLOCK_SIZE);
+			data = c->wb_buf + pos;
+			data->ch.node_type = UBIFS_DATA_NODE;
+			data_key_init(c, &key, inode->i_ino, block + n);
+			key_write(c, &key, &data->key);
+			data->size = cpu_to_le32(blen);
+			zero_data_node_unused(data);
+
+			if (!(ui->flags & UBIFS_COMPR_FL))
+				/* Compression is disabled for this inode */
+				compr_type = UBIFS_COMPR_NONE;
+			else
+				compr_type = ui->compr_type;
+
+			out_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+			ubifs_compress(addr + j, blen, &data->data, &out_len,
+				       &compr_type);
+			ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
+			data->compr_type = cpu_to_le16(compr_type);
+
+			dlen[n] = UBIFS_DATA_NODE_SZ + out_len;
+			memset((void *)data + dlen[n], 0,
+			       ALIGN(dlen[n], 8) - dlen[n]);
+			pos += ALIGN(dlen[n], 8);
+			n += 1;
+		}
+		kunmap(pages[i]);
+	}
+
+	pos = 0;
+	for (first = 0; first < n; first = i) {
+		/* Make reservation before allocating sequence numbers */
+		err = make_reservation(c, DATAHD, dlen[first]);
+		if (err)
+			goto out_unlock;
+
+		/*
+		 * The reservation only guarantees room for the first node, take
+		 * as many of the following ones as the head LEB can fit.
+		 */
+		avail = c->leb_size - wbuf->offs - wbuf->used;
+		wlen = 0;
+		for (i = first; i < n; i++) {
+			if (i > first && wlen + ALIGN(dlen[i], 8) > avail)
+				break;
+			ubifs_prepare_node(c, c->wb_buf + pos + wlen, dlen[i], 0);
+			wlen += ALIGN(dlen[i], 8);
+		}
+
+		err = write_head(c, DATAHD, c->wb_buf + pos, wlen, &lnum, &offs,
+				 0);
+		if (err)
+			goto out_release;
+		ubifs_wbuf_add_ino_nolock(wbuf, inode->i_ino);
+		release_head(c, DATAHD);
+
+		for (j = first; j < i; j++) {
+			data_key_init(c, &key, inode->i_ino, block + j);
+			err = ubifs_tnc_add(c, &key, lnum, offs, dlen[j]);
+			if (err)
+				goto out_ro;
+			offs += ALIGN(dlen[j], 8);
+		}
+
+		finish_reservation(c);
+		pos += wlen;
+	}
+
+	mutex_unlock(&c->wb_mutex);
+	return 0;
+
+out_release:
+	release_head(c, DATAHD);
+out_ro:
+	ubifs_ro_mode(c, err);
+	finish_reservation(c);
+out_unlock:
+	mutex_unlock(&c->wb_mutex);
+	return err;
+}
+
 /**
  * ubifs_jnl_write_inode - flush inode to the journal.
  * @c: UBIFS file-system description object
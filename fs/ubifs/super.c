@@ -47,6 +47,9 @@
 /* Slab cache for UBIFS inodes */
 struct kmem_cache *ubifs_inode_slab;
 
+/* Workqueue bulk-read uses to decompress on other CPUs */
+struct workqueue_struct *ubifs_bu_wq;
+
 /* UBIFS TNC shrinker description */
 static struct shrinker ubifs_shrinker_info = {
 	.shrink = ubifs_shrinker,
@@ -790,6 +793,12 @@ static int alloc_wbufs(struct ubifs_info *c)
 	c->jheads[GCHD].wbuf.dtype = UBI_LONGTERM;
 	c->jheads[GCHD].wbuf.no_timer = 1;
 
+	/* Write-back falls back to one data node at a time without it */
+	c->wb_buf = vmalloc(UBIFS_WB_BUF_SZ);
+	if (!c->wb_buf)
+		ubifs_warn("cannot allocate %d bytes of memory for write-back "
+			   "batches", UBIFS_WB_BUF_SZ);
+
 	return 0;
 }
 
@@ -809,6 +818,8 @@ static void free_wbufs(struct ubifs_info *c)
 		kfree(c->jheads);
 		c->jheads = NULL;
 	}
+	vfree(c->wb_buf);
+	c->wb_buf = NULL;
 }
 
 /**
@@ -1912,6 +1923,7 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	mutex_init(&c->mst_mutex);
 	mutex_init(&c->umount_mutex);
 	mutex_init(&c->bu_mutex);
+	mutex_init(&c->wb_mutex);
 	init_waitqueue_head(&c->cmt_wq);
 	c->buds = RB_ROOT;
 	c->old_idx = RB_ROOT;
@@ -2188,6 +2200,10 @@ static int __init ubifs_init(void)
 	if (err)
 		goto out_compr;
 
+	/* Bulk-read decompresses on the calling CPU only without it */
+	if (num_possible_cpus() > 1)
+		ubifs_bu_wq = create_workqueue("ubifs_bulk");
+
 	return 0;
 
 out_compr:
@@ -2207,6 +2223,8 @@ static void __exit ubifs_exit(void)
 	ubifs_assert(list_empty(&ubifs_infos));
 	ubifs_assert(atomic_long_read(&ubifs_clean_zn_cnt) == 0);
 
+	if (ubifs_bu_wq)
+		destroy_workqueue(ubifs_bu_wq);
 	dbg_debugfs_exit();
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
@@ -152,6 +152,21 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * Maximum number of data blocks written back in one go by
+ * 'ubifs_jnl_write_pages()', the number of pages this makes, and the size of
+ * the buffer the blocks are compressed to (the last node is compressed with
+ * the worst case room).
+ */
+#define UBIFS_WB_BLOCKS 16
+#define UBIFS_WB_PAGES (UBIFS_WB_BLOCKS >> UBIFS_BLOCKS_PER_PAGE_SHIFT)
+#define UBIFS_WB_BUF_SZ ((UBIFS_WB_BLOCKS - 1) * UBIFS_MAX_DATA_NODE_SZ + \
+			 UBIFS_DATA_NODE_SZ + \
+			 UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR)
+
+/* Minimum number of pages a bulk-read decompresses on one CPU */
+#define UBIFS_BU_CPU_PAGES 4
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -805,19 +820,35 @@ struct ubifs_node_range {
 };
 
 /**
- * struct ubifs_compressor - UBIFS compressor description structure.
- * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
+ * struct ubifs_compr_ctx - per-CPU compressor context.
  * @cc: cryptoapi compressor handle
  * @comp_mutex: mutex used during compression
  * @decomp_mutex: mutex used during decompression
+ */
+struct ubifs_compr_ctx {
+	struct crypto_comp *cc;
+	struct mutex comp_mutex;
+	struct mutex decomp_mutex;
+};
+
+/**
+ * struct ubifs_compressor - UBIFS compressor description structure.
+ * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
+ * @ctx: per-CPU compressor contexts, with handles allocated on first use
+ * @fallback: context used by CPUs which have no handle of their own yet
+ * @ctx_mutex: serializes allocation of the per-CPU handles
+ * @comp_lock: compression has to be serialized on @ctx->comp_mutex
+ * @decomp_lock: decompression has to be serialized on @ctx->decomp_mutex
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
  */
 struct ubifs_compressor {
 	int compr_type;
-	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct ubifs_compr_ctx *ctx;
+	struct ubifs_compr_ctx fallback;
+	struct mutex ctx_mutex;
+	unsigned int comp_lock:1;
+	unsigned int decomp_lock:1;
 	const char *name;
 	const char *capi_name;
 };
@@ -997,6 +1028,9 @@ struct ubifs_debug_info;
  * @max_bu_buf_len: maximum bulk-read buffer length
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
+ * @wb_buf: buffer write-back compresses data nodes to (%UBIFS_WB_BUF_SZ
+ *          bytes, %NULL if it could not be allocated or in R/O mode)
+ * @wb_mutex: protects @wb_buf
  *
  * @log_lebs: number of logical eraseblocks in the log
  * @log_bytes: log size in bytes
@@ -1239,6 +1273,8 @@ struct ubifs_info {
 	int max_bu_buf_len;
 	struct mutex bu_mutex;
 	struct bu_info bu;
+	void *wb_buf;
+	struct mutex wb_mutex;
 
 	int log_lebs;
 	long long log_bytes;
@@ -1414,6 +1450,7 @@ extern struct list_head ubifs_infos;
 extern spinlock_t ubifs_infos_lock;
 extern atomic_long_t ubifs_clean_zn_cnt;
 extern struct kmem_cache *ubifs_inode_slab;
+extern struct workqueue_struct *ubifs_bu_wq;
 extern const struct super_operations ubifs_super_operations;
 extern const struct address_space_operations ubifs_file_address_operations;
 extern const struct file_operations ubifs_file_operations;
@@ -1479,6 +1516,8 @@ int ubifs_jnl_update(struct ubifs_info *c, const struct inode *dir,
 		     int deletion, int xent);
 int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len);
+int ubifs_jnl_write_pages(struct ubifs_info *c, const struct inode *inode,
+			  struct page **pages, int cnt, int len);
 int ubifs_jnl_write_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_delete_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_rename(struct ubifs_info *c, const struct inode *old_dir,
@@ -0,0 +1,90 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_ctx;
+
+/*
+ * One hardware dispatch queue. Requests are staged on the per-cpu software
+ * queues of the CPUs that map to it and handed to the driver in batches.
+ */
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* protects dispatch */
+	struct list_head	dispatch;	/* bounced by the driver */
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	void			*driver_data;
+	unsigned int		queue_num;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+
+	/*
+	 * Tag space. Every tag owns one preallocated request, so getting a
+	 * tag is all it takes to allocate a request.
+	 */
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	struct request		*rqs;
+	wait_queue_head_t	tag_wait;
+
+	unsigned long		queued;
+	unsigned long		dispatched;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Queue request. Called without any block layer locks held, from
+	 * process context.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Optional per hardware queue setup and teardown, e.g. to point
+	 * ->driver_data at a driver side ring.
+	 */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;
+	int			numa_node;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_S_STOPPED	= 0,	/* driver is out of resources */
+	BLK_MQ_S_RUNNING	= 1,	/* somebody is dispatching */
+	BLK_MQ_S_PENDING	= 2,	/* new requests since last dispatch */
+	BLK_MQ_S_FROZEN		= 3,	/* a barrier is draining the queue */
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+extern struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_free_queue(struct request_queue *);
+
+extern void blk_mq_end_io(struct request *rq, int error);
+
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+extern void blk_mq_start_stopped_hw_queues(struct request_queue *q);
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif
@@ -301,6 +301,7 @@ extern struct dentry *d_ancestor(struct dentry *, struct dentry *);
 /* appendix may either be NULL or be used for transname suffixes */
 extern struct dentry * d_lookup(struct dentry *, struct qstr *);
 extern struct dentry * __d_lookup(struct dentry *, struct qstr *);
+extern struct dentry *__d_lookup_noref(struct dentry *, struct qstr *);
 extern struct dentry * d_hash_and_lookup(struct dentry *, struct qstr *);
 
 /* validate "insecure" dentry pointer */
@@ -341,6 +342,16 @@ static inline struct dentry *dget(struct dentry *dentry)
 
 extern struct dentry * dget_locked(struct dentry *);
 
+/*
+ * Take a reference on a hashed dentry whose d_lock is held, such as one
+ * returned by __d_lookup_noref().  Unlike dget(), the count may be zero.
+ */
+static inline struct dentry *dget_dlock(struct dentry *dentry)
+{
+	atomic_inc(&dentry->d_count);
+	return dentry;
+}
+
 /**
  *	d_unhashed -	is dentry hashed
  *	@dentry: entry to check
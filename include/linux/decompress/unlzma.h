@@ -1,6 +1,8 @@
 #ifndef DECOMPRESS_UNLZMA_H
 #define DECOMPRESS_UNLZMA_H
 
+#include <linux/types.h>
+
 int unlzma(unsigned char *, int,
 	   int(*fill)(void*, unsigned int),
 	   int(*flush)(void*, unsigned int),
@@ -9,4 +11,16 @@ int unlzma(unsigned char *, int,
 	   void(*error)(char *x)
 	);
 
+/* Size of the probability table of a stream with the given lc + lp */
+#define UNLZMA_PROBS(lclp)	(1846 + (0x300 << (lclp)))
+
+int unlzma_probs(unsigned char *, int,
+		 int(*fill)(void*, unsigned int),
+		 int(*flush)(void*, unsigned int),
+		 unsigned char *output,
+		 int *posp,
+		 void(*error)(char *x),
+		 uint16_t *probs, int nr_probs
+	);
+
 #endif
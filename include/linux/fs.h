@@ -882,6 +882,19 @@ struct fown_struct {
 /*
  * Track a single file's readahead state
  */
+/*
+ * Number of readahead windows remembered for streams other than the one
+ * in file_ra_state itself, so interleaved streams on one file do not reset
+ * each other's window.
+ */
+#define RA_STREAMS	3
+
+struct ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+};
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
@@ -891,6 +904,10 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	struct ra_stream streams[RA_STREAMS];	/* other streams, MRU first */
+	unsigned long stride;		/* distance between strided reads */
+	unsigned int stride_hits;	/* # of misses at @stride in a row */
 };
 
 /*
@@ -2476,6 +2493,8 @@ ssize_t simple_attr_write(struct file *file, const char __user *buf,
 struct ctl_table;
 int proc_nr_files(struct ctl_table *table, int write,
 		  void __user *buffer, size_t *lenp, loff_t *ppos);
+int proc_nr_inodes(struct ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos);
 
 int __init get_filesystem_list(char *buf);
 
@@ -27,6 +27,7 @@ enum {
 };
 
 struct loop_func_table;
+struct loop_extent;
 
 struct loop_device {
 	int		lo_number;
@@ -65,6 +66,12 @@ struct loop_device {
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
 	struct list_head	lo_list;
+
+	/* block map of the backing file, for LO_FLAGS_DIRECT_IO */
+	struct block_device	*lo_direct_bdev;
+	struct loop_extent	*lo_extents;
+	unsigned int		lo_nr_extents;
+	atomic_t		lo_pending;	/* remapped bios, +1 while bound */
 };
 
 #endif /* __KERNEL__ */
@@ -76,6 +83,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_IO	= 16,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
@@ -970,6 +970,7 @@ struct sched_domain {
 	unsigned int lb_hot_gained[CPU_MAX_IDLE_TYPES];
 	unsigned int lb_nobusyg[CPU_MAX_IDLE_TYPES];
 	unsigned int lb_nobusyq[CPU_MAX_IDLE_TYPES];
+	unsigned int lb_sleepy[CPU_MAX_IDLE_TYPES];
 
 	/* Active load balancing */
 	unsigned int alb_count;
@@ -990,6 +991,8 @@ struct sched_domain {
 	unsigned int ttwu_wake_remote;
 	unsigned int ttwu_move_affine;
 	unsigned int ttwu_move_balance;
+	unsigned int ttwu_move_idle;
+	unsigned int ttwu_wake_wide;
 #endif
 #ifdef CONFIG_SCHED_DEBUG
 	char *name;
@@ -1129,6 +1132,20 @@ struct load_weight {
  *     4 se->sleep_start
  *     6 se->load.weight
  */
+#ifdef CONFIG_SMP
+/*
+ * Decayed history of how runnable an entity was: the time it was runnable
+ * and the time it was tracked, both in ~1us units, each 1ms period
+ * weighing y (y^32 = 1/2) as much as the following one.
+ */
+struct sched_avg {
+	u32			runnable_avg_sum;
+	u32			runnable_avg_period;
+	u64			last_runnable_update;
+	unsigned long		load_avg_contrib;
+};
+#endif
+
 struct sched_entity {
 	struct load_weight	load;		/* for load-balancing */
 	struct rb_node		run_node;
@@ -1150,6 +1167,10 @@ struct sched_entity {
 
 	u64			avg_running;
 
+#ifdef CONFIG_SMP
+	struct sched_avg	avg;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	u64			wait_start;
 	u64			wait_max;
@@ -1170,6 +1191,7 @@ struct sched_entity {
 	u64			nr_migrations_cold;
 	u64			nr_failed_migrations_affine;
 	u64			nr_failed_migrations_running;
+	u64			nr_failed_migrations_packed;
 	u64			nr_failed_migrations_hot;
 	u64			nr_forced_migrations;
 	u64			nr_forced2_migrations;
@@ -1225,6 +1247,10 @@ struct task_struct {
 #ifdef __ARCH_WANT_UNLOCKED_CTXSW
 	int oncpu;
 #endif
+	/* wakeup pattern, see record_wakee() */
+	struct task_struct *last_wakee;
+	unsigned int wakee_flips;
+	unsigned long wakee_flip_decay_ts;
 #endif
 
 	int prio, static_prio, normal_prio;
@@ -1449,6 +1475,11 @@ struct task_struct {
 /* stacked block device info */
 	struct bio *bio_list, **bio_tail;
 
+#ifdef CONFIG_BLOCK
+/* stack plugging */
+	struct blk_plug *plug;
+#endif
+
 /* VM state */
 	struct reclaim_state *reclaim_state;
 
@@ -1733,6 +1764,7 @@ extern cputime_t task_gtime(struct task_struct *p);
 #define PF_EXITING	0x00000004	/* getting shut down */
 #define PF_EXITPIDONE	0x00000008	/* pi exit done on shut down */
 #define PF_VCPU		0x00000010	/* I'm a virtual CPU */
+#define PF_WQ_WORKER	0x00000020	/* I'm a workqueue worker */
 #define PF_FORKNOEXEC	0x00000040	/* forked but didn't exec */
 #define PF_MCE_PROCESS  0x00000080      /* process policy on mce errors */
 #define PF_SUPERPRIV	0x00000100	/* used super-user privileges */
@@ -1924,6 +1956,18 @@ static inline unsigned int get_sysctl_timer_migration(void)
 extern unsigned int sysctl_sched_rt_period;
 extern int sysctl_sched_rt_runtime;
 
+#ifdef CONFIG_SMP
+extern unsigned int sysctl_sched_packing_threshold;
+extern unsigned int sysctl_sched_packing_small;
+
+extern int sched_packing_util(int cpu);
+#else
+static inline int sched_packing_util(int cpu)
+{
+	return -1;
+}
+#endif
+
 int sched_rt_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp,
 		loff_t *ppos);
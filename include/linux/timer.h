@@ -17,6 +17,9 @@ struct timer_list {
 	unsigned long data;
 
 	struct tvec_base *base;
+
+	int slack;
+
 #ifdef CONFIG_TIMER_STATS
 	void *start_site;
 	char start_comm[16];
@@ -48,6 +51,7 @@ extern struct tvec_base boot_tvec_bases;
 		.expires = (_expires),				\
 		.data = (_data),				\
 		.base = &boot_tvec_bases,			\
+		.slack = -1,					\
 		__TIMER_LOCKDEP_MAP_INITIALIZER(		\
 			__FILE__ ":" __stringify(__LINE__))	\
 	}
@@ -165,6 +169,8 @@ extern int mod_timer(struct timer_list *timer, unsigned long expires);
 extern int mod_timer_pending(struct timer_list *timer, unsigned long expires);
 extern int mod_timer_pinned(struct timer_list *timer, unsigned long expires);
 
+extern void set_timer_slack(struct timer_list *timer, int slack_hz);
+
 #define TIMER_NOT_PINNED	0
 #define TIMER_PINNED		1
 /*
@@ -180,6 +186,23 @@ extern int mod_timer_pinned(struct timer_list *timer, unsigned long expires);
  */
 extern unsigned long get_next_timer_interrupt(unsigned long now);
 
+/*
+ * Timer slack statistics:
+ */
+enum {
+	TIMER_SLACK_WHEEL,
+	TIMER_SLACK_HRTIMER,
+	NR_TIMER_SLACK_TYPES,
+};
+
+#ifdef CONFIG_TIMER_SLACK_STATS
+extern void timer_slack_account_round(int type);
+extern void timer_slack_account_expiry(int type, unsigned int nr);
+#else
+static inline void timer_slack_account_round(int type) { }
+static inline void timer_slack_account_expiry(int type, unsigned int nr) { }
+#endif
+
 /*
  * Timer-statistics info:
  */
@@ -59,6 +59,8 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +68,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Priority Inheritance state:
  */
@@ -130,9 +130,69 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The system-wide table is sized at boot from the number of possible
+ * CPUs, so that bucket lock contention does not grow with the machine.
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashsize __read_mostly;
+
+static void futex_hash_init(struct futex_hash_bucket *fh, unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		plist_head_init(&fh[i].chain, &fh[i].lock);
+		spin_lock_init(&fh[i].lock);
+	}
+}
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * Futexes with FUTEX_PRIVATE_FLAG hash into mm->futex_hash instead.  The
+ * table is allocated by the first private futex operation of the process
+ * and is never replaced, so every private key of an mm always maps to
+ * the same bucket.
+ */
+static unsigned long futex_private_hashsize __read_mostly;
+
+static int futex_private_hash_prepare(void)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *fh;
+
+	if (likely(!mm || mm->futex_hash))
+		return 0;
+
+	fh = kmalloc(futex_private_hashsize * sizeof(*fh), GFP_KERNEL);
+	if (!fh)
+		return -ENOMEM;
+	futex_hash_init(fh, futex_private_hashsize);
+
+	/* Another thread of this mm may have beaten us to it */
+	if (cmpxchg(&mm->futex_hash, NULL, fh) != NULL)
+		kfree(fh);
+
+	return 0;
+}
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_hash = NULL;
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
+}
+#else
+static inline int futex_private_hash_prepare(void)
+{
+	return 0;
+}
+#endif
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -142,7 +202,18 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED))) {
+		struct futex_hash_bucket *fh = key->private.mm->futex_hash;
+
+		if (fh) {
+			smp_read_barrier_depends();
+			return &fh[hash & (futex_private_hashsize - 1)];
+		}
+	}
+#endif
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -2530,6 +2601,12 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 
 	if (!(op & FUTEX_PRIVATE_FLAG))
 		fshared = 1;
+	else {
+		ret = futex_private_hash_prepare();
+		if (ret)
+			return ret;
+		ret = -ENOSYS;
+	}
 
 	clockrt = op & FUTEX_CLOCK_REALTIME;
 	if (clockrt && cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI)
@@ -2619,8 +2696,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2636,10 +2713,23 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_hash_init(futex_queues, futex_hashsize);
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	futex_private_hashsize = roundup_pow_of_two(4 * num_possible_cpus());
+	futex_private_hashsize = clamp(futex_private_hashsize, 16UL, 256UL);
+#endif
 
 	return 0;
 }
@@ -1249,6 +1249,7 @@ void hrtimer_interrupt(struct clock_event_device *dev)
 	struct hrtimer_cpu_base *cpu_base = &__get_cpu_var(hrtimer_bases);
 	struct hrtimer_clock_base *base;
 	ktime_t expires_next, now;
+	unsigned int nr_run = 0;
 	int nr_retries = 0;
 	int i;
 
@@ -1312,6 +1313,7 @@ void hrtimer_interrupt(struct clock_event_device *dev)
 			}
 
 			__run_hrtimer(timer, &basenow);
+			nr_run++;
 		}
 		base++;
 	}
@@ -1323,6 +1325,11 @@ void hrtimer_interrupt(struct clock_event_device *dev)
 	cpu_base->expires_next = expires_next;
 	spin_unlock(&cpu_base->lock);
 
+	if (nr_run) {
+		timer_slack_account_expiry(TIMER_SLACK_HRTIMER, nr_run);
+		nr_run = 0;
+	}
+
 	/* Reprogramming necessary ? */
 	if (expires_next.tv64 != KTIME_MAX) {
 		if (tick_program_event(expires_next, force_clock_reprogram))
@@ -1407,6 +1414,7 @@ void hrtimer_run_queues(void)
 	struct rb_node *node;
 	struct hrtimer_cpu_base *cpu_base = &__get_cpu_var(hrtimer_bases);
 	struct hrtimer_clock_base *base;
+	unsigned int nr_run = 0;
 	int index, gettime = 1;
 
 	if (hrtimer_hres_active())
@@ -1434,9 +1442,13 @@ void hrtimer_run_queues(void)
 				break;
 
 			__run_hrtimer(timer, &base->softirq_time);
+			nr_run++;
 		}
 		spin_unlock(&cpu_base->lock);
 	}
+
+	if (nr_run)
+		timer_slack_account_expiry(TIMER_SLACK_HRTIMER, nr_run);
 }
 
 /*
@@ -76,6 +76,7 @@
 #include <asm/irq_regs.h>
 
 #include "sched_cpupri.h"
+#include "workqueue_sched.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -407,6 +408,14 @@ struct cfs_rq {
 
 	unsigned int nr_spread_over;
 
+#ifdef CONFIG_SMP
+	/*
+	 * Sum of the load_avg_contrib of the entities queued here, the load
+	 * the balancer sees when LOAD_AVG is set.
+	 */
+	unsigned long runnable_load_avg;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -586,6 +595,9 @@ struct rq {
 
 	unsigned long avg_load_per_task;
 
+	/* How much of the recent past CFS tasks were runnable here */
+	struct sched_avg avg;
+
 	struct task_struct *migration_thread;
 	struct list_head migration_queue;
 
@@ -630,6 +642,26 @@ struct rq {
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
+#ifdef CONFIG_SMP
+/*
+ * Number of cpus sharing the last level cache with this one, see
+ * update_llc_size().
+ */
+static DEFINE_PER_CPU(int, sd_llc_size);
+
+/*
+ * The cpu small tasks of this one are packed on, or -1 if it has no
+ * domain, see update_pack_buddy().
+ */
+static DEFINE_PER_CPU(int, sd_pack_buddy);
+
+/* Do the cpus of @sd share a cache, as SMT siblings or package cores do? */
+static inline int sd_shares_cache(struct sched_domain *sd)
+{
+	return sd->flags & (SD_SHARE_CPUPOWER | SD_SHARE_PKG_RESOURCES);
+}
+#endif
+
 static inline
 void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags)
 {
@@ -1492,9 +1524,24 @@ static int tg_nop(struct task_group *tg, void *data)
 /* Used instead of source_load when we know the type == 0 */
 static unsigned long weighted_cpuload(const int cpu)
 {
+	if (sched_feat(LOAD_AVG))
+		return cpu_rq(cpu)->cfs.runnable_load_avg;
+
 	return cpu_rq(cpu)->load.weight;
 }
 
+/*
+ * The load @p puts on its cpu: with LOAD_AVG its weight scaled by the
+ * part of the recent past it was runnable.
+ */
+static unsigned long task_load(struct task_struct *p)
+{
+	if (sched_feat(LOAD_AVG))
+		return p->se.avg.load_avg_contrib;
+
+	return p->se.load.weight;
+}
+
 /*
  * Return a low guess at the load of a migration-source cpu weighted
  * according to the scheduling class and "nice" value.
@@ -1556,7 +1603,7 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 	unsigned long nr_running = ACCESS_ONCE(rq->nr_running);
 
 	if (nr_running)
-		rq->avg_load_per_task = rq->load.weight / nr_running;
+		rq->avg_load_per_task = weighted_cpuload(cpu) / nr_running;
 	else
 		rq->avg_load_per_task = 0;
 
@@ -2076,6 +2123,7 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 	if (p->se.block_start)
 		p->se.block_start -= clock_offset;
 #endif
+	p->se.avg.last_runnable_update -= clock_offset;
 	if (old_cpu != new_cpu) {
 		p->se.nr_migrations++;
 		new_rq->nr_migrations_in++;
@@ -2416,6 +2464,13 @@ out_activate:
 	activate_task(rq, p, 1);
 	success = 1;
 
+	/*
+	 * Let a workqueue worker's pool know it is running again, see
+	 * wq_worker_sleeping().
+	 */
+	if (p->flags & PF_WQ_WORKER)
+		wq_worker_waking_up(p, cpu);
+
 	/*
 	 * Only attribute actual wakeups done by this task.
 	 */
@@ -2448,6 +2503,50 @@ out:
 	return success;
 }
 
+/**
+ * try_to_wake_up_local - try to wake up a local task with rq lock held
+ * @p: the thread to be awakened
+ *
+ * Put @p on the run-queue if it's not alredy there.  The caller must
+ * ensure that this_rq() is locked, @p is bound to this_rq() and not
+ * the current task.  this_rq() stays locked over invocation.
+ */
+static void try_to_wake_up_local(struct task_struct *p)
+{
+	struct rq *rq = task_rq(p);
+	int success = 0;
+
+	BUG_ON(rq != this_rq());
+	BUG_ON(p == current);
+	assert_spin_locked(&rq->lock);
+
+	if (!(p->state & TASK_NORMAL))
+		return;
+
+	if (!p->se.on_rq) {
+		if (likely(!task_running(rq, p))) {
+			schedstat_inc(rq, ttwu_count);
+			schedstat_inc(rq, ttwu_local);
+		}
+		schedstat_inc(p, se.nr_wakeups);
+		schedstat_inc(p, se.nr_wakeups_local);
+		activate_task(rq, p, 1);
+		success = 1;
+
+		if (p->flags & PF_WQ_WORKER)
+			wq_worker_waking_up(p, cpu_of(rq));
+	}
+
+	trace_sched_wakeup(rq, p, success);
+	check_preempt_curr(rq, p, 0);
+
+	p->state = TASK_RUNNING;
+#ifdef CONFIG_SMP
+	if (p->sched_class->task_wake_up)
+		p->sched_class->task_wake_up(rq, p);
+#endif
+}
+
 /**
  * wake_up_process - Wake up a specific process
  * @p: The process to be woken up.
@@ -2488,6 +2587,18 @@ static void __sched_fork(struct task_struct *p)
 	p->se.avg_wakeup		= sysctl_sched_wakeup_granularity;
 	p->se.avg_running		= 0;
 
+#ifdef CONFIG_SMP
+	/* Count a new task as runnable until it shows otherwise */
+	p->se.avg.runnable_avg_sum	= LOAD_AVG_MAX;
+	p->se.avg.runnable_avg_period	= LOAD_AVG_MAX;
+	p->se.avg.last_runnable_update	= 0;
+	p->se.avg.load_avg_contrib	= 0;
+
+	p->last_wakee			= NULL;
+	p->wakee_flips			= 0;
+	p->wakee_flip_decay_ts		= jiffies;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	p->se.wait_start			= 0;
 	p->se.wait_max				= 0;
@@ -2506,6 +2617,7 @@ static void __sched_fork(struct task_struct *p)
 	p->se.nr_migrations_cold		= 0;
 	p->se.nr_failed_migrations_affine	= 0;
 	p->se.nr_failed_migrations_running	= 0;
+	p->se.nr_failed_migrations_packed	= 0;
 	p->se.nr_failed_migrations_hot		= 0;
 	p->se.nr_forced_migrations		= 0;
 	p->se.nr_forced2_migrations		= 0;
@@ -2614,6 +2726,9 @@ void wake_up_new_task(struct task_struct *p, unsigned long clone_flags)
 	rq = task_rq_lock(p, &flags);
 	BUG_ON(p->state != TASK_RUNNING);
 	update_rq_clock(rq);
+#ifdef CONFIG_SMP
+	p->se.avg.last_runnable_update = rq->clock;
+#endif
 
 	if (!p->sched_class->task_new || !current->se.on_rq) {
 		activate_task(rq, p, 0);
@@ -3032,7 +3147,11 @@ u64 cpu_nr_migrations(int cpu)
  */
 static void update_cpu_load(struct rq *this_rq)
 {
+#ifdef CONFIG_SMP
+	unsigned long this_load = weighted_cpuload(cpu_of(this_rq));
+#else
 	unsigned long this_load = this_rq->load.weight;
+#endif
 	int i, scale;
 
 	this_rq->nr_load_updates++;
@@ -3192,6 +3311,11 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	}
 	*all_pinned = 0;
 
+	if (task_packed(p, cpu_of(rq))) {
+		schedstat_inc(p, se.nr_failed_migrations_packed);
+		return 0;
+	}
+
 	if (task_running(rq, p)) {
 		schedstat_inc(p, se.nr_failed_migrations_running);
 		return 0;
@@ -3245,15 +3369,27 @@ next:
 	if (!p || loops++ > sysctl_sched_nr_migrate)
 		goto out;
 
-	if ((p->se.load.weight >> 1) > rem_load_move ||
+	if ((task_load(p) >> 1) > rem_load_move ||
 	    !can_migrate_task(p, busiest, this_cpu, sd, idle, &pinned)) {
 		p = iterator->next(iterator->arg);
 		goto next;
 	}
 
+	/*
+	 * A task that was runnable only a small part of the recent past
+	 * will most likely go back to sleep before moving it pays off,
+	 * and moving it does little for the imbalance.
+	 */
+	if (sched_feat(LOAD_AVG) && task_load(p) < p->se.load.weight / 8 &&
+	    sd->nr_balance_failed <= sd->cache_nice_tries) {
+		schedstat_inc(sd, lb_sleepy[idle]);
+		p = iterator->next(iterator->arg);
+		goto next;
+	}
+
 	pull_task(busiest, p, this_rq, this_cpu);
 	pulled++;
-	rem_load_move -= p->se.load.weight;
+	rem_load_move -= task_load(p);
 
 #ifdef CONFIG_PREEMPT
 	/*
@@ -5406,6 +5542,18 @@ pick_next_task(struct rq *rq)
 	}
 }
 
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	/*
+	 * If we are going to sleep and we have plugged IO queued,
+	 * make sure to submit it to avoid deadlocks.
+	 */
+	if (blk_needs_flush_plug(tsk))
+		blk_schedule_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -5416,6 +5564,7 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -5439,8 +5588,22 @@ need_resched_nonpreemptible:
 	if (prev->state && !(preempt_count() & PREEMPT_ACTIVE)) {
 		if (unlikely(signal_pending_state(prev->state, prev)))
 			prev->state = TASK_RUNNING;
-		else
+		else {
+			/*
+			 * If a worker is going to sleep, notify and
+			 * ask workqueue whether it wants to wake up a
+			 * task to maintain concurrency.  If so, wake
+			 * up the task.
+			 */
+			if (prev->flags & PF_WQ_WORKER) {
+				struct task_struct *to_wakeup;
+
+				to_wakeup = wq_worker_sleeping(prev, cpu);
+				if (to_wakeup)
+					try_to_wake_up_local(to_wakeup);
+			}
 			deactivate_task(rq, prev, 1);
+		}
 		switch_count = &prev->nvcsw;
 	}
 
@@ -8003,6 +8166,37 @@ static struct root_domain *alloc_rootdomain(void)
 	return rd;
 }
 
+/*
+ * Record the span of the largest domain of @cpu whose cpus share its
+ * cache, that is how many cpus a wakeup can spread over cheaply.
+ */
+static void update_llc_size(struct sched_domain *sd, int cpu)
+{
+	int size = 1;
+
+	for (; sd && sd_shares_cache(sd); sd = sd->parent)
+		size = cpumask_weight(sched_domain_span(sd));
+
+	per_cpu(sd_llc_size, cpu) = size;
+}
+
+/*
+ * Small tasks are packed on the first cpu of the largest domain of @cpu
+ * whose cpus share its cache, or of its base domain if none do (as on
+ * parts whose cores are only described by the top level domain), so
+ * the other cores of the package can stay in deep idle states.
+ */
+static void update_pack_buddy(struct sched_domain *sd, int cpu)
+{
+	struct sched_domain *pack = sd;
+
+	for (; sd && sd_shares_cache(sd); sd = sd->parent)
+		pack = sd;
+
+	per_cpu(sd_pack_buddy, cpu) =
+		pack ? cpumask_first(sched_domain_span(pack)) : -1;
+}
+
 /*
  * Attach the domain 'sd' to 'cpu' as its base domain. Callers must
  * hold the hotplug lock.
@@ -8037,6 +8231,8 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 
 	rq_attach_root(rq, rd);
 	rcu_assign_pointer(rq->sd, sd);
+	update_llc_size(sd, cpu);
+	update_pack_buddy(sd, cpu);
 }
 
 /* cpus with isolated domains */
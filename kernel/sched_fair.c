@@ -73,6 +73,19 @@ unsigned int sysctl_sched_wakeup_granularity = 1000000UL;
 
 const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
 
+#ifdef CONFIG_SMP
+/*
+ * Small task packing: tasks runnable less than sysctl_sched_packing_small
+ * percent of the time are woken on the first cpu of their package, and
+ * left there by the balancer, as long as that cpu is runnable less than
+ * sysctl_sched_packing_threshold percent of the time. This keeps the
+ * other cores idle long enough to reach their deep idle states.
+ * (default: off, a threshold of 0 disables packing)
+ */
+unsigned int sysctl_sched_packing_threshold;
+unsigned int sysctl_sched_packing_small = 20;
+#endif
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -623,6 +636,229 @@ account_entity_dequeue(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	se->on_rq = 0;
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking
+ *
+ * Each entity keeps a geometric series of the time it was runnable:
+ * the time is split in 1024us periods, and the runnable time of the
+ * period i periods ago counts y^i as much as that of the current one,
+ * with y chosen so that y^32 = 1/2. A task's contribution to the load
+ * of its cfs_rq is its weight scaled by runnable_avg_sum over
+ * runnable_avg_period. A group entity does the same with its per cpu
+ * share of the group, so the history of the group's tasks on this cpu
+ * propagates up to the cpu's load.
+ */
+
+/* Most the sums can get, and how many periods it takes to get there */
+#define LOAD_AVG_PERIOD	32
+#define LOAD_AVG_MAX	47742
+#define LOAD_AVG_MAX_N	347
+
+/* Precomputed y^n * 2^32, for 0 <= n < LOAD_AVG_PERIOD */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2db, 0xf5257d15, 0xefe4b99b, 0xeac0c6e7, 0xe5b906e7,
+	0xe0ccdeec, 0xdbfbb797, 0xd744fcca, 0xd2a81d91, 0xce248c15, 0xc9b9bd86,
+	0xc5672a11, 0xc12c4cca, 0xbd08a39f, 0xb8fbaf47, 0xb504f333, 0xb123f581,
+	0xad583eea, 0xa9a15ab4, 0xa5fed6a9, 0xa2704303, 0x9ef53260, 0x9b8d39b9,
+	0x9837f051, 0x94f4efa8, 0x91c3d373, 0x8ea4398b, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/* Precomputed \Sum 1024*y^k for 1 <= k <= n, for 0 <= n <= LOAD_AVG_PERIOD */
+static const u32 runnable_avg_yN_sum[] = {
+	    0,  1002,  1982,  2941,  3879,  4797,  5696,  6575,  7436,  8278,
+	 9102,  9908, 10697, 11469, 12225, 12965, 13689, 14397, 15090, 15768,
+	16432, 17081, 17716, 18338, 18947, 19543, 20126, 20696, 21254, 21800,
+	22334, 22857, 23369,
+};
+
+/* Approximate val * y^n */
+static u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	local_n = n;
+	/* y^32 = 1/2, so whole multiples of 32 periods are shifts */
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	return val >> 32;
+}
+
+/* \Sum 1024*y^k for 1 <= k <= n: what n fully runnable periods add */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	/* Add in the contributions of LOAD_AVG_PERIOD periods at a time */
+	do {
+		contrib /= 2;
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Account the time since the last update as runnable or not, decaying
+ * the history at every period boundary crossed. Returns whether the
+ * sums decayed, that is whether the contribution needs recomputing.
+ */
+static int
+__update_entity_runnable_avg(u64 now, struct sched_avg *sa, int runnable)
+{
+	u64 delta, periods;
+	u32 runnable_contrib;
+	int delta_w, decayed = 0;
+
+	delta = now - sa->last_runnable_update;
+	/*
+	 * The rq clocks of two cpus are not synchronized, a task that just
+	 * moved may see time going backwards; start over from here.
+	 */
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	/* Use 1024ns as the unit, close enough to 1us and cheaper */
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update = now;
+
+	/* The part of the current period already accounted */
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		decayed = 1;
+
+		/* Complete the current period first */
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += delta_w;
+		sa->runnable_avg_period += delta_w;
+		delta -= delta_w;
+
+		/* Then decay the history by the periods that went by */
+		periods = delta >> 10;
+		delta &= 1023;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		/* and add the full periods in between */
+		runnable_contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += runnable_contrib;
+		sa->runnable_avg_period += runnable_contrib;
+	}
+
+	/* The remainder starts the new current period */
+	if (runnable)
+		sa->runnable_avg_sum += delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/* Recompute the load @se contributes, return by how much it changed */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+	u64 contrib;
+
+	contrib = (u64)se->avg.runnable_avg_sum * se->load.weight;
+	se->avg.load_avg_contrib = div_u64(contrib,
+					   se->avg.runnable_avg_period + 1);
+
+	return se->avg.load_avg_contrib - old_contrib;
+}
+
+static inline void
+sub_runnable_load_avg(struct cfs_rq *cfs_rq, unsigned long load)
+{
+	if (likely(load < cfs_rq->runnable_load_avg))
+		cfs_rq->runnable_load_avg -= load;
+	else
+		cfs_rq->runnable_load_avg = 0;
+}
+
+/* Bring the history of a queued entity up to date */
+static void update_entity_load_avg(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	long contrib_delta;
+
+	if (!__update_entity_runnable_avg(rq_of(cfs_rq)->clock, &se->avg,
+					  se->on_rq))
+		return;
+
+	contrib_delta = __update_entity_load_avg_contrib(se);
+	if (!se->on_rq)
+		return;
+
+	if (contrib_delta >= 0)
+		cfs_rq->runnable_load_avg += contrib_delta;
+	else
+		sub_runnable_load_avg(cfs_rq, -contrib_delta);
+}
+
+/*
+ * Called before @se is queued: the time since it was last tracked is
+ * the time it slept (or zero for a task the balancer is moving), and its
+ * weight may have changed, so its contribution is always recomputed.
+ */
+static void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	__update_entity_runnable_avg(rq_of(cfs_rq)->clock, &se->avg, 0);
+	__update_entity_load_avg_contrib(se);
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+}
+
+/* Called while @se is still queued */
+static void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	sub_runnable_load_avg(cfs_rq, se->avg.load_avg_contrib);
+}
+
+/*
+ * Track how much of the time CFS tasks were runnable on @rq, regardless
+ * of their weight: the utilization small task packing is bounded by.
+ */
+static inline void update_rq_runnable_avg(struct rq *rq, int runnable)
+{
+	__update_entity_runnable_avg(rq->clock, &rq->avg, runnable);
+}
+#else
+static inline void update_rq_runnable_avg(struct rq *rq, int runnable) { }
+static inline void update_entity_load_avg(struct sched_entity *se) { }
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se) { }
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se) { }
+#endif
+
 static void enqueue_sleeper(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
 #ifdef CONFIG_SCHEDSTATS
@@ -747,6 +983,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int wakeup)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	enqueue_entity_load_avg(cfs_rq, se);
 	account_entity_enqueue(cfs_rq, se);
 
 	if (wakeup) {
@@ -801,6 +1038,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int sleep)
 
 	if (se != cfs_rq->curr)
 		__dequeue_entity(cfs_rq, se);
+	dequeue_entity_load_avg(cfs_rq, se);
 	account_entity_dequeue(cfs_rq, se);
 	update_min_vruntime(cfs_rq);
 }
@@ -903,8 +1141,10 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 	 * If still on the runqueue then deactivate_task()
 	 * was not called and update_curr() has to be done:
 	 */
-	if (prev->on_rq)
+	if (prev->on_rq) {
 		update_curr(cfs_rq);
+		update_entity_load_avg(prev);
+	}
 
 	check_spread(cfs_rq, prev);
 	if (prev->on_rq) {
@@ -922,6 +1162,7 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	update_entity_load_avg(curr);
 
 #ifdef CONFIG_SCHED_HRTICK
 	/*
@@ -1014,6 +1255,8 @@ static void enqueue_task_fair(struct rq *rq, struct task_struct *p, int wakeup)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	update_rq_runnable_avg(rq, rq->cfs.nr_running);
+
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -1035,6 +1278,8 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	update_rq_runnable_avg(rq, 1);
+
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		dequeue_entity(cfs_rq, se, sleep);
@@ -1215,14 +1460,14 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	 */
 	if (sync) {
 		tg = task_group(current);
-		weight = current->se.load.weight;
+		weight = task_load(current);
 
 		this_load += effective_load(tg, this_cpu, -weight, -weight);
 		load += effective_load(tg, prev_cpu, 0, -weight);
 	}
 
 	tg = task_group(p);
-	weight = p->se.load.weight;
+	weight = task_load(p);
 
 	imbalance = 100 + (sd->imbalance_pct - 100) / 2;
 
@@ -1266,6 +1511,89 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	return 0;
 }
 
+/*
+ * Track how often current switches between the tasks it wakes up. A task
+ * that keeps waking the same partner (a pipe or IPC ping-pong) flips
+ * rarely, one that feeds a pool of workers flips on nearly every wakeup.
+ * The count is halved every second so it follows the recent pattern.
+ */
+static void record_wakee(struct task_struct *p)
+{
+	if (time_after(jiffies, current->wakee_flip_decay_ts + HZ)) {
+		current->wakee_flips >>= 1;
+		current->wakee_flip_decay_ts = jiffies;
+	}
+
+	if (current->last_wakee != p) {
+		current->last_wakee = p;
+		current->wakee_flips++;
+	}
+}
+
+/*
+ * Detect a 1:N waker/wakee relationship with N larger than the number of
+ * cpus sharing a cache: the wakee flips between partners itself, and the
+ * waker does so that many times more often. Pulling all of those wakees
+ * onto the waker's cpu would only stack them up, so let them spread.
+ */
+static int wake_wide(struct task_struct *p)
+{
+	unsigned int master = current->wakee_flips;
+	unsigned int slave = p->wakee_flips;
+	unsigned int factor = max(__get_cpu_var(sd_llc_size), 2);
+
+	if (master < slave)
+		swap(master, slave);
+	if (slave < factor || master < slave * factor)
+		return 0;
+	return 1;
+}
+
+/*
+ * Find an idle cpu sharing a cache with @target to wake @p on, so that it
+ * runs right away instead of waiting behind the task running on @target.
+ * @p's previous cpu is preferred, its caches may still be warm.
+ */
+static int select_idle_sibling(struct task_struct *p, int target, int sync)
+{
+	int cpu = smp_processor_id();
+	int prev_cpu = task_cpu(p);
+	struct sched_domain *sd;
+	int i;
+
+	if (idle_cpu(target))
+		return target;
+
+	/*
+	 * The waker is about to sleep and leave its cpu, with hot L1 and L2,
+	 * to @p; moving @p to a sibling would only cost cache misses.
+	 */
+	if (sync && target == cpu && cpu_rq(cpu)->nr_running == 1 &&
+	    current->se.avg_overlap < sysctl_sched_migration_cost)
+		return target;
+
+	for_each_domain(target, sd) {
+		if (!sd_shares_cache(sd))
+			break;
+
+		if (prev_cpu != target && idle_cpu(prev_cpu) &&
+		    cpumask_test_cpu(prev_cpu, sched_domain_span(sd)) &&
+		    cpumask_test_cpu(prev_cpu, &p->cpus_allowed)) {
+			schedstat_inc(sd, ttwu_move_idle);
+			return prev_cpu;
+		}
+
+		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
+			if (idle_cpu(i)) {
+				schedstat_inc(sd, ttwu_move_idle);
+				return i;
+			}
+		}
+	}
+
+	return target;
+}
+
 /*
  * find_idlest_group finds and returns the least busy CPU group within the
  * domain.
@@ -1344,6 +1672,99 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+/* Percentage of the recent past @sa was runnable */
+static inline unsigned int runnable_pct(struct sched_avg *sa)
+{
+	return sa->runnable_avg_sum * 100 / (sa->runnable_avg_period + 1);
+}
+
+static inline int is_small_task(struct sched_avg *sa)
+{
+	return runnable_pct(sa) < sysctl_sched_packing_small;
+}
+
+/*
+ * The utilization of @cpu, decayed up to now: an idle cpu does not
+ * update its own. Racy against the cpu's updates, but only a hint.
+ */
+static unsigned int cpu_packing_util(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct sched_avg sa = rq->avg;
+
+	__update_entity_runnable_avg(sched_clock_cpu(cpu), &sa,
+				     rq->cfs.nr_running);
+	return runnable_pct(&sa);
+}
+
+/* Is @cpu a packing target that can take more small tasks? */
+static int pack_buddy_has_room(int cpu, unsigned int extra)
+{
+	if (!sysctl_sched_packing_threshold ||
+	    per_cpu(sd_pack_buddy, cpu) != cpu)
+		return 0;
+
+	return cpu_packing_util(cpu) + extra < sysctl_sched_packing_threshold;
+}
+
+/*
+ * The cpu to wake the small task @p on to pack it with others, or -1 to
+ * place it as usual.
+ */
+static int select_pack_buddy(struct task_struct *p)
+{
+	int buddy = per_cpu(sd_pack_buddy, task_cpu(p));
+	struct sched_avg sa = p->se.avg;
+	unsigned int extra = 0;
+
+	if (!sysctl_sched_packing_threshold || buddy < 0)
+		return -1;
+
+	/* @p is waking up: its average still ends where it went to sleep */
+	__update_entity_runnable_avg(sched_clock_cpu(task_cpu(p)), &sa, 0);
+	if (!is_small_task(&sa))
+		return -1;
+
+	if (!cpumask_test_cpu(buddy, &p->cpus_allowed))
+		return -1;
+
+	/* Its past runs are in the buddy's utilization already */
+	if (task_cpu(p) != buddy)
+		extra = runnable_pct(&sa);
+
+	return pack_buddy_has_room(buddy, extra) ? buddy : -1;
+}
+
+/* Should the balancer leave @p packed on @cpu? */
+static int task_packed(struct task_struct *p, int cpu)
+{
+	return sysctl_sched_packing_threshold && is_small_task(&p->se.avg) &&
+	       pack_buddy_has_room(cpu, 0);
+}
+
+/**
+ * sched_packing_util - utilization of a cpu small tasks are packed on
+ * @cpu: the cpu to look at
+ *
+ * Returns the percentage of the recent past CFS tasks were runnable on
+ * @cpu if small tasks are being packed on it, -1 otherwise. Meant for
+ * cpufreq governors: the scheduler keeps the packed load below
+ * sysctl_sched_packing_threshold by itself, by spreading tasks again
+ * beyond it, so there is no need to jump to the highest frequency for it.
+ */
+int sched_packing_util(int cpu)
+{
+	unsigned int util;
+
+	if (!sysctl_sched_packing_threshold ||
+	    per_cpu(sd_pack_buddy, cpu) != cpu)
+		return -1;
+
+	util = cpu_packing_util(cpu);
+	return util < sysctl_sched_packing_threshold ? util : -1;
+}
+EXPORT_SYMBOL_GPL(sched_packing_util);
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -1366,6 +1787,13 @@ static int select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flag
 	int sync = wake_flags & WF_SYNC;
 
 	if (sd_flag & SD_BALANCE_WAKE) {
+		if (sched_feat(WAKE_WIDE) && !in_interrupt())
+			record_wakee(p);
+
+		new_cpu = select_pack_buddy(p);
+		if (new_cpu >= 0)
+			return new_cpu;
+
 		if (sched_feat(AFFINE_WAKEUPS) &&
 		    cpumask_test_cpu(cpu, &p->cpus_allowed))
 			want_affine = 1;
@@ -1429,9 +1857,17 @@ static int select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flag
 			update_shares(tmp);
 	}
 
-	if (affine_sd && wake_affine(affine_sd, p, sync)) {
-		new_cpu = cpu;
-		goto out;
+	if (affine_sd) {
+		if (sched_feat(WAKE_WIDE) && wake_wide(p))
+			schedstat_inc(affine_sd, ttwu_wake_wide);
+		else if (wake_affine(affine_sd, p, sync))
+			new_cpu = cpu;
+
+		if (new_cpu == cpu || !sd) {
+			if (sched_feat(IDLE_SIBLING))
+				new_cpu = select_idle_sibling(p, new_cpu, sync);
+			goto out;
+		}
 	}
 
 	while (sd) {
@@ -1860,6 +2296,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &curr->se;
 
+	update_rq_runnable_avg(rq, 1);
+
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
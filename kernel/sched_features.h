@@ -74,6 +74,24 @@ SCHED_FEAT(SYNC_WAKEUPS, 1)
  */
 SCHED_FEAT(AFFINE_WAKEUPS, 1)
 
+/*
+ * Wake a task on an idle cpu sharing the cache with the cpu picked by
+ * AFFINE_WAKEUPS rather than queueing it behind a running task there.
+ */
+SCHED_FEAT(IDLE_SIBLING, 1)
+
+/*
+ * Don't pull the wakees of a task that wakes many different tasks onto
+ * its cpu, let them spread instead, see wake_wide().
+ */
+SCHED_FEAT(WAKE_WIDE, 1)
+
+/*
+ * Balance the cpus on the decayed runnable history of their tasks rather
+ * than on the weight of the tasks queued at the instant of balancing.
+ */
+SCHED_FEAT(LOAD_AVG, 1)
+
 /*
  * Weaken SYNC hint based on overlap
  */
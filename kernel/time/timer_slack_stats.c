@@ -0,0 +1,152 @@
+/*
+ * kernel/time/timer_slack_stats.c
+ *
+ * Statistics on how well timer slack coalesces timer expiries.
+ *
+ * Every time the timer wheel or the hrtimer code expires timers, the
+ * number of timers expired together is added to a histogram. All but the
+ * first timer of such a batch were wakeups saved compared to every timer
+ * firing on its own. The number of timers whose expiry was moved by
+ * rounding to a shared slot is counted as well; only the wheel rounds,
+ * hrtimers already share interrupts through their soft/hard range.
+ *
+ * Display the information collected so far:
+ * # cat /sys/kernel/debug/timer_slack
+ *
+ * Reset it:
+ * # echo 0 > /sys/kernel/debug/timer_slack
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/timer.h>
+
+/* Batches of 1, 2, 3-4, 5-8, ... timers, the last bucket is open ended */
+#define SLACK_HIST_BUCKETS	8
+
+struct timer_slack_stats {
+	unsigned long rounded;
+	unsigned long expiries;
+	unsigned long timers;
+	unsigned long hist[SLACK_HIST_BUCKETS];
+};
+
+/*
+ * The counters are only updated by the local cpu. Updates are not atomic
+ * against interrupts, an occasional lost count does not matter here.
+ */
+static DEFINE_PER_CPU(struct timer_slack_stats [NR_TIMER_SLACK_TYPES],
+		      timer_slack_stats);
+
+static const char *timer_slack_names[NR_TIMER_SLACK_TYPES] = {
+	[TIMER_SLACK_WHEEL]	= "wheel",
+	[TIMER_SLACK_HRTIMER]	= "hrtimer",
+};
+
+void timer_slack_account_round(int type)
+{
+	get_cpu_var(timer_slack_stats)[type].rounded++;
+	put_cpu_var(timer_slack_stats);
+}
+
+void timer_slack_account_expiry(int type, unsigned int nr)
+{
+	struct timer_slack_stats *stats;
+	int bucket = fls(nr - 1);
+
+	if (bucket >= SLACK_HIST_BUCKETS)
+		bucket = SLACK_HIST_BUCKETS - 1;
+
+	stats = &get_cpu_var(timer_slack_stats)[type];
+	stats->expiries++;
+	stats->timers += nr;
+	stats->hist[bucket]++;
+	put_cpu_var(timer_slack_stats);
+}
+
+static int timer_slack_show(struct seq_file *m, void *v)
+{
+	struct timer_slack_stats sum[NR_TIMER_SLACK_TYPES];
+	int cpu, type, i;
+
+	memset(sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		struct timer_slack_stats *stats;
+
+		stats = per_cpu(timer_slack_stats, cpu);
+
+		for (type = 0; type < NR_TIMER_SLACK_TYPES; type++) {
+			sum[type].rounded += stats[type].rounded;
+			sum[type].expiries += stats[type].expiries;
+			sum[type].timers += stats[type].timers;
+			for (i = 0; i < SLACK_HIST_BUCKETS; i++)
+				sum[type].hist[i] += stats[type].hist[i];
+		}
+	}
+
+	seq_printf(m, "%-8s %12s %12s %12s %12s\n", "",
+		   "rounded", "expiries", "timers", "saved");
+	for (type = 0; type < NR_TIMER_SLACK_TYPES; type++)
+		seq_printf(m, "%-8s %12lu %12lu %12lu %12lu\n",
+			   timer_slack_names[type], sum[type].rounded,
+			   sum[type].expiries, sum[type].timers,
+			   sum[type].timers - sum[type].expiries);
+
+	seq_printf(m, "\n%-8s %12s %12s\n", "batch",
+		   timer_slack_names[TIMER_SLACK_WHEEL],
+		   timer_slack_names[TIMER_SLACK_HRTIMER]);
+	for (i = 0; i < SLACK_HIST_BUCKETS; i++) {
+		unsigned int lo = i ? (1U << (i - 1)) + 1 : 1, hi = 1U << i;
+		char range[16];
+
+		if (i == SLACK_HIST_BUCKETS - 1)
+			snprintf(range, sizeof(range), "%u-", lo);
+		else if (lo == hi)
+			snprintf(range, sizeof(range), "%u", lo);
+		else
+			snprintf(range, sizeof(range), "%u-%u", lo, hi);
+		seq_printf(m, "%-8s %12lu %12lu\n", range,
+			   sum[TIMER_SLACK_WHEEL].hist[i],
+			   sum[TIMER_SLACK_HRTIMER].hist[i]);
+	}
+	return 0;
+}
+
+static ssize_t timer_slack_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *offs)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(timer_slack_stats, cpu), 0,
+		       sizeof(per_cpu(timer_slack_stats, cpu)));
+	return count;
+}
+
+static int timer_slack_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, timer_slack_show, NULL);
+}
+
+static const struct file_operations timer_slack_fops = {
+	.open		= timer_slack_open,
+	.read		= seq_read,
+	.write		= timer_slack_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init init_timer_slack_stats(void)
+{
+	debugfs_create_file("timer_slack", 0644, NULL, NULL,
+			    &timer_slack_fops);
+	return 0;
+}
+__initcall(init_timer_slack_stats);
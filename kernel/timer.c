@@ -549,6 +549,7 @@ static void __init_timer(struct timer_list *timer,
 {
 	timer->entry.next = NULL;
 	timer->base = __raw_get_cpu_var(tvec_bases);
+	timer->slack = -1;
 #ifdef CONFIG_TIMER_STATS
 	timer->start_site = NULL;
 	timer->start_pid = -1;
@@ -700,6 +701,52 @@ out_unlock:
 	return ret;
 }
 
+/*
+ * Decide where to put the timer while taking the slack into account
+ *
+ * Algorithm:
+ *   1) calculate the maximum (absolute) time
+ *   2) calculate the highest bit where the expires and new max are different
+ *   3) use this bit to make a mask
+ *   4) use the bitmask to round down the maximum time, so that all last
+ *      bits are zeros
+ *
+ * Timers whose windows overlap end up on the same "round" jiffy this way,
+ * so they expire together and the cpu wakes up once for all of them.
+ */
+static inline
+unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
+{
+	unsigned long expires_limit, mask;
+	int bit;
+
+	expires_limit = expires;
+
+	if (timer->slack >= 0) {
+		expires_limit = expires + timer->slack;
+	} else {
+		unsigned long now = jiffies;
+
+		/* No slack, if already expired else auto slack 0.4% */
+		if (time_after(expires, now))
+			expires_limit = expires + (expires - now)/256;
+	}
+	mask = expires ^ expires_limit;
+	if (mask == 0)
+		return expires;
+
+	bit = find_last_bit(&mask, BITS_PER_LONG);
+
+	mask = (1UL << bit) - 1;
+
+	expires_limit = expires_limit & ~(mask);
+
+	if (expires_limit != expires)
+		timer_slack_account_round(TIMER_SLACK_WHEEL);
+
+	return expires_limit;
+}
+
 /**
  * mod_timer_pending - modify a pending timer's timeout
  * @timer: the pending timer to be modified
@@ -712,6 +759,8 @@ out_unlock:
  */
 int mod_timer_pending(struct timer_list *timer, unsigned long expires)
 {
+	expires = apply_slack(timer, expires);
+
 	return __mod_timer(timer, expires, true, TIMER_NOT_PINNED);
 }
 EXPORT_SYMBOL(mod_timer_pending);
@@ -735,9 +784,14 @@ EXPORT_SYMBOL(mod_timer_pending);
  * The function returns whether it has modified a pending timer or not.
  * (ie. mod_timer() of an inactive timer returns 0, mod_timer() of an
  * active timer returns 1.)
+ *
+ * The timer may fire up to its slack (see set_timer_slack()) after
+ * @expires, at a jiffy shared with other timers.
  */
 int mod_timer(struct timer_list *timer, unsigned long expires)
 {
+	expires = apply_slack(timer, expires);
+
 	/*
 	 * This is a common optimization triggered by the
 	 * networking code - if the timer is re-modified
@@ -772,6 +826,27 @@ int mod_timer_pinned(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pinned);
 
+/**
+ * set_timer_slack - set the allowed slack for a timer
+ * @timer: the timer to be modified
+ * @slack_hz: the amount of time (in jiffies) allowed for rounding
+ *
+ * Set the amount of time, in jiffies, that a certain timer has
+ * in terms of slack. By setting this value, the timer subsystem
+ * will schedule the actual timer somewhere between
+ * the time mod_timer() asks for, and that time plus the slack.
+ *
+ * By setting the slack to -1, a percentage of the delay is used
+ * instead.  This is the default; housekeeping timers that tolerate
+ * more delay should set a larger slack so that they share wakeups
+ * with other timers.
+ */
+void set_timer_slack(struct timer_list *timer, int slack_hz)
+{
+	timer->slack = slack_hz;
+}
+EXPORT_SYMBOL_GPL(set_timer_slack);
+
 /**
  * add_timer - start a timer
  * @timer: the timer to be added
@@ -973,6 +1048,7 @@ static inline void __run_timers(struct tvec_base *base)
 		struct list_head work_list;
 		struct list_head *head = &work_list;
 		int index = base->timer_jiffies & TVR_MASK;
+		unsigned int nr = 0;
 
 		/*
 		 * Cascade timers:
@@ -993,6 +1069,7 @@ static inline void __run_timers(struct tvec_base *base)
 			data = timer->data;
 
 			timer_stats_account_timer(timer);
+			nr++;
 
 			set_running_timer(base, timer);
 			detach_timer(timer, 1);
@@ -1039,6 +1116,8 @@ static inline void __run_timers(struct tvec_base *base)
 			}
 			spin_lock_irq(&base->lock);
 		}
+		if (nr)
+			timer_slack_account_expiry(TIMER_SLACK_WHEEL, nr);
 	}
 	set_running_timer(base, NULL);
 	spin_unlock_irq(&base->lock);
@@ -1349,6 +1428,11 @@ static void process_timeout(unsigned long __data)
  * value will be %MAX_SCHEDULE_TIMEOUT.
  *
  * In all cases the return value is guaranteed to be non-negative.
+ *
+ * The wakeup may be delayed by the task's timer slack (prctl
+ * %PR_SET_TIMERSLACK), rounded down to whole jiffies.  For %SCHED_IDLE
+ * tasks the timer is deferrable: an idle cpu does not wake up just for
+ * it, the task runs when the cpu next wakes up for something else.
  */
 signed long __sched schedule_timeout(signed long timeout)
 {
@@ -1387,7 +1471,12 @@ signed long __sched schedule_timeout(signed long timeout)
 	expire = timeout + jiffies;
 
 	setup_timer_on_stack(&timer, process_timeout, (unsigned long)current);
-	__mod_timer(&timer, expire, false, TIMER_NOT_PINNED);
+	if (current->policy == SCHED_IDLE)
+		timer_set_deferrable(&timer);
+	set_timer_slack(&timer, min_t(unsigned long, INT_MAX,
+				      current->timer_slack_ns / TICK_NSEC));
+	__mod_timer(&timer, apply_slack(&timer, expire), false,
+		    TIMER_NOT_PINNED);
 	schedule();
 	del_singleshot_timer_sync(&timer);
 
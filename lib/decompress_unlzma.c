@@ -34,6 +34,9 @@
 #else
 #include <linux/decompress/unlzma.h>
 #include <linux/slab.h>
+#include <linux/module.h>
+/* squashfs calls unlzma() long after boot, keep it out of .init.text */
+#define INIT
 #endif /* STATIC */
 
 #include <linux/decompress/mm.h>
@@ -74,6 +77,7 @@ struct rc {
 	uint32_t code;
 	uint32_t range;
 	uint32_t bound;
+	int error;
 };
 
 
@@ -87,16 +91,34 @@ static int nofill(void *buffer, unsigned int len)
 	return -1;
 }
 
-/* Called twice: once at startup and once in rc_normalize() */
+/*
+ * Once the input has run out rc->error is set and the decoder is fed
+ * zeroes, which keeps it within its buffers until __unlzma() stops.
+ */
 static void INIT rc_read(struct rc *rc)
 {
+	if (rc->error)
+		return;
 	rc->buffer_size = rc->fill((char *)rc->buffer, LZMA_IOBUF_SIZE);
-	if (rc->buffer_size <= 0)
+	if (rc->buffer_size <= 0) {
 		error("unexpected EOF");
+		rc->error = 1;
+		rc->buffer_size = 0;
+	}
 	rc->ptr = rc->buffer;
 	rc->buffer_end = rc->buffer + rc->buffer_size;
 }
 
+static inline uint8_t INIT rc_get_byte(struct rc *rc)
+{
+	if (rc->ptr >= rc->buffer_end) {
+		rc_read(rc);
+		if (rc->error)
+			return 0;
+	}
+	return *rc->ptr++;
+}
+
 /* Called once */
 static inline void INIT rc_init(struct rc *rc,
 				       int (*fill)(void*, unsigned int),
@@ -113,17 +135,15 @@ static inline void INIT rc_init(struct rc *rc,
 
 	rc->code = 0;
 	rc->range = 0xFFFFFFFF;
+	rc->error = 0;
 }
 
 static inline void INIT rc_init_code(struct rc *rc)
 {
 	int i;
 
-	for (i = 0; i < 5; i++) {
-		if (rc->ptr >= rc->buffer_end)
-			rc_read(rc);
-		rc->code = (rc->code << 8) | *rc->ptr++;
-	}
+	for (i = 0; i < 5; i++)
+		rc->code = (rc->code << 8) | rc_get_byte(rc);
 }
 
 
@@ -136,10 +156,8 @@ static inline void INIT rc_free(struct rc *rc)
 /* Called twice, but one callsite is in inline'd rc_is_bit_0_helper() */
 static void INIT rc_do_normalize(struct rc *rc)
 {
-	if (rc->ptr >= rc->buffer_end)
-		rc_read(rc);
 	rc->range <<= 8;
-	rc->code = (rc->code << 8) | *rc->ptr++;
+	rc->code = (rc->code << 8) | rc_get_byte(rc);
 }
 static inline void INIT rc_normalize(struct rc *rc)
 {
@@ -301,6 +319,15 @@ static inline size_t INIT get_pos(struct writer *wr)
 		wr->global_pos + wr->buffer_pos;
 }
 
+/*
+ * A match can only reach back into the dictionary, and not before the
+ * first byte written: both are up to the stream, so check them.
+ */
+static inline int INIT bad_distance(struct writer *wr, uint32_t offs)
+{
+	return offs > wr->header->dict_size || offs > get_pos(wr);
+}
+
 static inline uint8_t INIT peek_old_byte(struct writer *wr,
 						uint32_t offs)
 {
@@ -387,7 +414,8 @@ static inline void INIT process_bit0(struct writer *wr, struct rc *rc,
 		cst->state -= 6;
 }
 
-static inline void INIT process_bit1(struct writer *wr, struct rc *rc,
+/* Returns -1 if the stream asks for a match out of range */
+static inline int INIT process_bit1(struct writer *wr, struct rc *rc,
 					    struct cstate *cst, uint16_t *p,
 					    int pos_state, uint16_t *prob) {
   int offset;
@@ -418,8 +446,10 @@ static inline void INIT process_bit1(struct writer *wr, struct rc *rc,
 
 				cst->state = cst->state < LZMA_NUM_LIT_STATES ?
 					9 : 11;
+				if (bad_distance(wr, cst->rep0))
+					return -1;
 				copy_byte(wr, cst->rep0);
-				return;
+				return 0;
 			} else {
 				rc_update_bit_1(rc, prob);
 			}
@@ -521,22 +551,30 @@ static inline void INIT process_bit1(struct writer *wr, struct rc *rc,
 		} else
 			cst->rep0 = pos_slot;
 		if (++(cst->rep0) == 0)
-			return;
+			return 0;
 	}
 
 	len += LZMA_MATCH_MIN_LEN;
 
+	if (bad_distance(wr, cst->rep0))
+		return -1;
 	copy_bytes(wr, cst->rep0, len);
+	return 0;
 }
 
 
 
-STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
+/*
+ * The probability table is taken from @probs if it has room for the
+ * @nr_probs entries the stream needs, otherwise it is allocated here.
+ */
+static inline int INIT __unlzma(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
 			      int(*flush)(void*, unsigned int),
 			      unsigned char *output,
 			      int *posp,
-			      void(*error_fn)(char *x)
+			      void(*error_fn)(char *x),
+			      uint16_t *probs, int nr_probs
 	)
 {
 	struct lzma_header header;
@@ -574,14 +612,15 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 
 	rc_init(&rc, fill, inbuf, in_len);
 
-	for (i = 0; i < sizeof(header); i++) {
-		if (rc.ptr >= rc.buffer_end)
-			rc_read(&rc);
-		((unsigned char *)&header)[i] = *rc.ptr++;
-	}
+	for (i = 0; i < sizeof(header); i++)
+		((unsigned char *)&header)[i] = rc_get_byte(&rc);
+	if (rc.error)
+		goto exit_1;
 
-	if (header.pos >= (9 * 5 * 5))
+	if (header.pos >= (9 * 5 * 5)) {
 		error("bad header");
+		goto exit_1;
+	}
 
 	mi = 0;
 	lc = header.pos;
@@ -614,7 +653,10 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		goto exit_1;
 
 	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp));
-	p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
+	if (num_probs <= nr_probs)
+		p = probs;
+	else
+		p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
 	if (p == 0)
 		goto exit_2;
 	num_probs = LZMA_LITERAL + (LZMA_LIT_SIZE << (lc + lp));
@@ -623,7 +665,7 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 
 	rc_init_code(&rc);
 
-	while (get_pos(&wr) < header.dst_size) {
+	while (get_pos(&wr) < header.dst_size && !rc.error) {
 		int pos_state =	get_pos(&wr) & pos_state_mask;
 		uint16_t *prob = p + LZMA_IS_MATCH +
 			(cst.state << LZMA_NUM_POS_BITS_MAX) + pos_state;
@@ -631,18 +673,25 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 			process_bit0(&wr, &rc, &cst, p, pos_state, prob,
 				     lc, literal_pos_mask);
 		else {
-			process_bit1(&wr, &rc, &cst, p, pos_state, prob);
+			if (process_bit1(&wr, &rc, &cst, p, pos_state, prob)) {
+				error("match distance out of range");
+				goto exit_3;
+			}
 			if (cst.rep0 == 0)
 				break;
 		}
 	}
+	if (rc.error)
+		goto exit_3;
 
 	if (posp)
 		*posp = rc.ptr-rc.buffer;
 	if (wr.flush)
 		wr.flush(wr.buffer, wr.buffer_pos);
 	ret = 0;
-	large_free(p);
+exit_3:
+	if (p != probs)
+		large_free(p);
 exit_2:
 	if (!output)
 		large_free(wr.buffer);
@@ -653,6 +702,39 @@ exit_0:
 	return ret;
 }
 
+STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
+			      int(*fill)(void*, unsigned int),
+			      int(*flush)(void*, unsigned int),
+			      unsigned char *output,
+			      int *posp,
+			      void(*error_fn)(char *x)
+	)
+{
+	return __unlzma(buf, in_len, fill, flush, output, posp, error_fn,
+			NULL, 0);
+}
+
+#ifndef PREBOOT
+EXPORT_SYMBOL(unlzma);
+
+/*
+ * unlzma() for callers that decompress many small streams and keep a
+ * probability table of UNLZMA_PROBS(lc + lp) entries around for them.
+ */
+int unlzma_probs(unsigned char *buf, int in_len,
+		 int(*fill)(void*, unsigned int),
+		 int(*flush)(void*, unsigned int),
+		 unsigned char *output,
+		 int *posp,
+		 void(*error_fn)(char *x),
+		 uint16_t *probs, int nr_probs)
+{
+	return __unlzma(buf, in_len, fill, flush, output, posp, error_fn,
+			probs, nr_probs);
+}
+EXPORT_SYMBOL(unlzma_probs);
+#endif
+
 #ifdef PREBOOT
 STATIC int INIT decompress(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
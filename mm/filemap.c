@@ -1415,6 +1415,8 @@ static int page_cache_read(struct file *file, pgoff_t offset)
 }
 
 #define MMAP_LOTSAMISS  (100)
+#define MMAP_READAROUND_MIN	(4)
+#define MMAP_READAROUND_RANDOM	(MMAP_LOTSAMISS / 4)
 
 /*
  * Synchronous readahead happens when we don't even find
@@ -1425,7 +1427,7 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 				   struct file *file,
 				   pgoff_t offset)
 {
-	unsigned long ra_pages;
+	unsigned long ra_pages, size;
 	struct address_space *mapping = file->f_mapping;
 
 	/* If we don't want any read-ahead, don't bother */
@@ -1450,15 +1452,28 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 		return;
 
 	/*
-	 * mmap read-around
+	 * mmap read-around. A fault next to the previous read-around window
+	 * means the faults are local, so double the window up to the maximum.
+	 * A fault anywhere else reads the full ra_pages, unless the faults
+	 * have kept missing what was read around before them: then they are
+	 * random and start over with a small window.
 	 */
 	ra_pages = max_sane_readahead(ra->ra_pages);
-	if (ra_pages) {
-		ra->start = max_t(long, 0, offset - ra_pages/2);
-		ra->size = ra_pages;
-		ra->async_size = 0;
-		ra_submit(ra, mapping, file);
-	}
+	if (!ra_pages)
+		return;
+
+	if (ra->size && offset + ra->size >= ra->start &&
+	    offset < ra->start + 2 * ra->size)
+		size = min_t(unsigned long, 2 * ra->size, ra_pages);
+	else if (ra->mmap_miss <= MMAP_READAROUND_RANDOM)
+		size = ra_pages;
+	else
+		size = min_t(unsigned long, MMAP_READAROUND_MIN, ra_pages);
+
+	ra->start = max_t(long, 0, offset - size/2);
+	ra->size = size;
+	ra->async_size = 0;
+	ra_submit(ra, mapping, file);
 }
 
 /*
@@ -26,6 +26,8 @@ file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
 	ra->prev_pos = -1;
+	memset(ra->streams, 0, sizeof(ra->streams));
+	ra->stride_hits = 0;
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
@@ -108,9 +110,12 @@ EXPORT_SYMBOL(read_cache_pages);
 static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
+	struct blk_plug plug;
 	unsigned page_idx;
 	int ret;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		/* Clean up the remaining pages */
@@ -129,6 +134,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	ret = 0;
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -320,6 +326,18 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * for sequential patterns. Hence interleaved reads might be served as
  * sequential ones.
  *
+ * The fields above describe one stream. When a read starts a window for
+ * another stream, the current window is pushed to the small ra->streams[]
+ * table. A later read that lands where one of those windows expects it makes
+ * that stream current again, with its window size intact. So a few streams
+ * interleaved on one fd (say, index and heap pages of a database read with
+ * pread) keep ramping up instead of restarting from the initial size.
+ *
+ * Random misses which keep the same distance from the previous request are
+ * a strided stream. Once the same stride is seen twice in a row, the next
+ * requests of the stride are read along with the current one, and their
+ * number ramps up like the window of a sequential stream does.
+ *
  * There is a special-case: if the first page which the application tries to
  * read happens to be the first page of the file, it is assumed that a linear
  * read is about to happen and the window is immediately set to the initial size
@@ -329,6 +347,59 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * it approaches max_readhead.
  */
 
+/*
+ * Push the current window to the front of ra->streams[] before it is replaced
+ * by the window of another stream. A window @offset falls in is of the same
+ * stream and is not worth remembering.
+ */
+static void ra_save_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	if (!ra->size)
+		return;
+	if (offset >= ra->start && offset <= ra->start + ra->size)
+		return;
+
+	memmove(&ra->streams[1], &ra->streams[0],
+		(RA_STREAMS - 1) * sizeof(struct ra_stream));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+}
+
+/*
+ * Does @offset continue one of the remembered streams? If so, make it the
+ * current stream and remember the current window in its place.
+ */
+static bool ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct ra_stream found;
+	int i;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		struct ra_stream *s = &ra->streams[i];
+
+		if (!s->size)
+			continue;
+		if (offset == s->start + s->size - s->async_size ||
+		    offset == s->start + s->size)
+			break;
+	}
+	if (i == RA_STREAMS)
+		return false;
+
+	found = ra->streams[i];
+	memmove(&ra->streams[1], &ra->streams[0],
+		i * sizeof(struct ra_stream));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+
+	ra->start = found.start;
+	ra->size = found.size;
+	ra->async_size = found.async_size;
+	return true;
+}
+
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
  * this count is a conservative estimation of
@@ -375,6 +446,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_save_stream(ra, offset);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -382,6 +454,49 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Strided reads: misses at a constant distance from the previous request.
+ * Returns the number of pages submitted, 0 if this is not a strided read.
+ */
+static unsigned long try_stride_readahead(struct address_space *mapping,
+					  struct file_ra_state *ra,
+					  struct file *filp, pgoff_t offset,
+					  unsigned long req_size,
+					  unsigned long max)
+{
+	pgoff_t prev = ra->prev_pos >> PAGE_CACHE_SHIFT;
+	unsigned long stride, nr, i, ret = 0;
+
+	if (ra->prev_pos == -1 || offset <= prev + 1) {
+		ra->stride_hits = 0;
+		return 0;
+	}
+
+	/* prev_pos is the last page of the previous request, of req_size */
+	stride = offset - prev + req_size - 1;
+	if (stride != ra->stride) {
+		ra->stride = stride;
+		ra->stride_hits = 1;
+		return 0;
+	}
+	if (++ra->stride_hits < 3)
+		return 0;
+
+	nr = 1UL << min(ra->stride_hits - 1, 8U);
+	nr = clamp(nr, 1UL, max / req_size);
+	for (i = 0; i < nr; i++) {
+		int actual;
+
+		actual = __do_page_cache_readahead(mapping, filp,
+					offset + i * stride, req_size, 0);
+		if (actual < 0)
+			break;
+		ret += actual;
+	}
+
+	return ret ? ret : 1;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -411,6 +526,17 @@ ondemand_readahead(struct address_space *mapping,
 		goto readit;
 	}
 
+	/*
+	 * The expected callback offset of another stream read through this
+	 * file: switch to that stream and push its window forward.
+	 */
+	if (ra_switch_stream(ra, offset)) {
+		ra->start += ra->size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -427,6 +553,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_save_stream(ra, offset);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -447,6 +574,19 @@ ondemand_readahead(struct address_space *mapping,
 	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
 		goto initial_readahead;
 
+	/*
+	 * A strided stream. The readahead state is left to the stream that
+	 * is sequential, if any.
+	 */
+	if (req_size <= max / 2) {
+		unsigned long ret;
+
+		ret = try_stride_readahead(mapping, ra, filp, offset,
+					   req_size, max);
+		if (ret)
+			return ret;
+	}
+
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
@@ -461,6 +601,7 @@ ondemand_readahead(struct address_space *mapping,
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra_save_stream(ra, offset);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -1493,6 +1493,70 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	unfreeze_slab(s, page, tail);
 }
 
+/*
+ * Per cpu partial slabs.
+ *
+ * A slab that gets its first free object back while it is not a cpu slab
+ * is frozen and kept on the partial list of the freeing cpu instead of
+ * being added to the node partial list. Refills of the cpu slab then
+ * take slabs from there without touching n->list_lock. Frozen slabs are
+ * not on any node list, so frees to them never touch the node lists
+ * either.
+ *
+ * Interrupts must be disabled. The list is only accessed by its own cpu,
+ * except for a cpu that is dead.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page;
+
+	while (!list_empty(&c->partial)) {
+		page = list_first_entry(&c->partial, struct page, lru);
+		list_del(&page->lru);
+		slab_lock(page);
+		unfreeze_slab(s, page, 1);
+	}
+	c->partial_objects = 0;
+	c->partial_pages = 0;
+}
+
+/*
+ * Must be called with the slab lock held and the slab frozen.
+ *
+ * Returns 1 if the cpu partial list went over its limit and needs to be
+ * drained with unfreeze_partials() after the slab lock is dropped.
+ */
+static int put_cpu_partial(struct kmem_cache *s, struct kmem_cache_cpu *c,
+				struct page *page)
+{
+	list_add(&page->lru, &c->partial);
+	c->partial_objects += page->objects - page->inuse;
+	c->partial_pages++;
+	stat(c, CPU_PARTIAL_FREE);
+
+	return c->partial_objects > s->cpu_partial;
+}
+
+static struct page *get_cpu_partial(struct kmem_cache_cpu *c, int node)
+{
+	struct page *page;
+
+	if (list_empty(&c->partial))
+		return NULL;
+
+	page = list_first_entry(&c->partial, struct page, lru);
+	if (node != -1 && page_to_nid(page) != node)
+		return NULL;
+
+	list_del(&page->lru);
+	c->partial_pages--;
+	if (list_empty(&c->partial))
+		c->partial_objects = 0;
+	stat(c, CPU_PARTIAL_ALLOC);
+	slab_lock(page);
+	return page;
+}
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(c, CPUSLAB_FLUSH);
@@ -1509,8 +1573,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
-		flush_slab(s, c);
+	if (likely(c)) {
+		if (c->page)
+			flush_slab(s, c);
+		unfreeze_partials(s, c);
+	}
 }
 
 static void flush_cpu_slab(void *d)
@@ -1657,6 +1724,12 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	new = get_cpu_partial(c, node);
+	if (new) {
+		c->page = new;
+		goto load_freelist;
+	}
+
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1822,9 +1895,23 @@ checks_ok:
 
 	/*
 	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * then add it: to this cpu's partial list if the slab is node local,
+	 * so that the node list_lock is avoided.
 	 */
 	if (unlikely(!prior)) {
+		if (s->cpu_partial && !(SLABDEBUG && PageSlubDebug(page)) &&
+				page_to_nid(page) == numa_node_id()) {
+			int drain;
+
+			__SetPageSlubFrozen(page);
+			drain = put_cpu_partial(s, c, page);
+			slab_unlock(page);
+			if (drain) {
+				unfreeze_partials(s, c);
+				stat(c, CPU_PARTIAL_DRAIN);
+			}
+			return;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(c, FREE_ADD_PARTIAL);
 	}
@@ -2077,6 +2164,9 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	INIT_LIST_HEAD(&c->partial);
+	c->partial_objects = 0;
+	c->partial_pages = 0;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2493,6 +2583,24 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+
+	/*
+	 * cpu_partial determines the maximum number of free objects kept
+	 * on the per cpu partial lists. Larger objects have fewer objects
+	 * per slab, so keep fewer of them. Debug caches must see every
+	 * free go through the node lists.
+	 */
+	if (s->flags & DEBUG_DEFAULT_FLAGS)
+		s->cpu_partial = 0;
+	else if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 6;
+	else if (s->size >= 256)
+		s->cpu_partial = 13;
+	else
+		s->cpu_partial = 30;
+
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -3977,6 +4085,28 @@ static ssize_t show_slab_objects(struct kmem_cache *s,
 			total += x;
 			nodes[node] += x;
 		}
+
+		/*
+		 * Slabs on the cpu partial lists are off the node lists, so
+		 * add them in. Only the slab count is kept for them; their
+		 * objects are not counted, as inuse changes on frees without
+		 * any lock we could take here. The count is read racily and
+		 * only ever holds node local slabs.
+		 */
+		if (!(flags & (SO_TOTAL | SO_OBJECTS))) {
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
+
+				if (!c)
+					continue;
+
+				x = ACCESS_ONCE(c->partial_pages);
+				total += x;
+				nodes[cpu_to_node(cpu)] += x;
+			}
+		}
 	}
 	x = sprintf(buf, "%lu", total);
 #ifdef CONFIG_NUMA
@@ -4088,6 +4218,29 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long objects;
+	int err;
+
+	err = strict_strtoul(buf, 10, &objects);
+	if (err)
+		return err;
+	if (objects && (s->flags & DEBUG_DEFAULT_FLAGS))
+		return -EINVAL;
+
+	s->cpu_partial = objects;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4396,6 +4549,9 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4404,6 +4560,7 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4450,6 +4607,9 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_drain_attr.attr,
 #endif
 	NULL
 };
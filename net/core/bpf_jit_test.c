@@ -0,0 +1,285 @@
+/*
+ * BPF JIT self test
+ *
+ * Runs a set of filters through both sk_run_filter() and the
+ * architecture JIT on the same packets and reports any difference.
+ * The module never stays loaded: it returns -EAGAIN once all tests
+ * passed and -EINVAL if any failed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/in.h>
+#include <net/net_namespace.h>
+
+/* Ethernet, IPv4 and TCP headers from port 22, and a short payload */
+static const u8 test_pkt[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+	0x45, 0x00, 0x00, 0x32, 0x12, 0x34, 0x40, 0x00,
+	0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+	0x0a, 0x00, 0x00, 0x02,
+	0x00, 0x16, 0x9c, 0x40, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x50, 0x18, 0x10, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+	'h', 'e', 'l', 'l', 'o', ',', ' ', 'b', 'p', 'f',
+};
+
+/* "tcp src port 22" as generated by tcpdump -d */
+static const struct sock_filter prog_tcp_port[] = {
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 8),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_TCP, 0, 6),
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0),
+	BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),
+	BPF_STMT(BPF_LD|BPF_H|BPF_IND, 14),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 22, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 0xffff),
+	BPF_STMT(BPF_RET|BPF_K, 0),
+};
+
+static const struct sock_filter prog_alu[] = {
+	BPF_STMT(BPF_LD|BPF_IMM, 0x12345678),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 0x1000),
+	BPF_STMT(BPF_LDX|BPF_IMM, 3),
+	BPF_STMT(BPF_ALU|BPF_MUL|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 0x10000001),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 7),
+	BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 3),
+	BPF_STMT(BPF_ALU|BPF_RSH|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_OR|BPF_K, 0xff000000),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xfff0ffff),
+	BPF_STMT(BPF_ALU|BPF_NEG, 0),
+	BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 0x10001),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 16),
+	BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_LSH|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_OR|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_AND|BPF_X, 0),
+	BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 1),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+static const struct sock_filter prog_div_zero[] = {
+	BPF_STMT(BPF_LD|BPF_IMM, 42),
+	BPF_STMT(BPF_LDX|BPF_IMM, 0),
+	BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+	BPF_STMT(BPF_RET|BPF_K, 1),
+};
+
+static const struct sock_filter prog_out_of_bounds[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 1000),
+	BPF_STMT(BPF_RET|BPF_K, 1),
+};
+
+static const struct sock_filter prog_loads[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 26),
+	BPF_STMT(BPF_ST, 1),
+	BPF_STMT(BPF_LDX|BPF_IMM, 30),
+	BPF_STMT(BPF_LD|BPF_W|BPF_IND, 4),
+	BPF_STMT(BPF_STX, 2),
+	BPF_STMT(BPF_LDX|BPF_MEM, 1),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_LDX|BPF_MEM, 0),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_LDX|BPF_W|BPF_LEN, 0),
+	BPF_STMT(BPF_LD|BPF_B|BPF_IND, -1),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+static const struct sock_filter prog_neg_offsets[] = {
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, SKF_NET_OFF + 9),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 12),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+static const struct sock_filter prog_ancillary[] = {
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_MISC|BPF_TAX, 0),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+	BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+	BPF_STMT(BPF_RET|BPF_A, 0),
+};
+
+static const struct sock_filter prog_jumps[] = {
+	BPF_STMT(BPF_LDX|BPF_IMM, 100),
+	BPF_STMT(BPF_LD|BPF_IMM, 200),
+	BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 1, 0),
+	BPF_STMT(BPF_RET|BPF_K, 1),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 201, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 2),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_X, 0, 0, 1),
+	BPF_STMT(BPF_JMP|BPF_JA, 1),
+	BPF_STMT(BPF_RET|BPF_K, 3),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x123456, 1, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 1, 1),
+	BPF_STMT(BPF_RET|BPF_K, 4),
+	BPF_STMT(BPF_MISC|BPF_TXA, 0),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_X, 0, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 5),
+	BPF_STMT(BPF_RET|BPF_K, 6),
+};
+
+#define TEST_NONLINEAR	(1 << 0)
+
+struct bpf_jit_test {
+	const char *name;
+	const struct sock_filter *insns;
+	unsigned int len;
+	unsigned int flags;
+};
+
+#define BPF_JIT_TEST(_name, _prog, _flags)	\
+	{ _name, _prog, ARRAY_SIZE(_prog), _flags }
+
+static const struct bpf_jit_test tests[] = {
+	BPF_JIT_TEST("tcp_port", prog_tcp_port, 0),
+	BPF_JIT_TEST("tcp_port_nonlinear", prog_tcp_port, TEST_NONLINEAR),
+	BPF_JIT_TEST("alu", prog_alu, 0),
+	BPF_JIT_TEST("div_zero", prog_div_zero, 0),
+	BPF_JIT_TEST("out_of_bounds", prog_out_of_bounds, 0),
+	BPF_JIT_TEST("loads", prog_loads, 0),
+	BPF_JIT_TEST("loads_nonlinear", prog_loads, TEST_NONLINEAR),
+	BPF_JIT_TEST("neg_offsets", prog_neg_offsets, 0),
+	BPF_JIT_TEST("ancillary", prog_ancillary, 0),
+	BPF_JIT_TEST("jumps", prog_jumps, 0),
+};
+
+/* linear packet, or only the first 20 bytes linear and the rest in a frag */
+static struct sk_buff *test_skb(unsigned int flags)
+{
+	unsigned int headlen = sizeof(test_pkt);
+	struct sk_buff *skb;
+
+	if (flags & TEST_NONLINEAR)
+		headlen = 20;
+
+	skb = alloc_skb(headlen, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	memcpy(skb_put(skb, headlen), test_pkt, headlen);
+
+	if (headlen < sizeof(test_pkt)) {
+		unsigned int rest = sizeof(test_pkt) - headlen;
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), test_pkt + headlen, rest);
+		skb_fill_page_desc(skb, 0, page, 0, rest);
+		skb->len += rest;
+		skb->data_len += rest;
+		skb->truesize += rest;
+	}
+
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = PACKET_HOST;
+	skb->dev = init_net.loopback_dev;
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	return skb;
+}
+
+static int run_test(const struct bpf_jit_test *test)
+{
+	unsigned int size = test->len * sizeof(struct sock_filter);
+	unsigned int interp, jit;
+	struct sk_filter *fp;
+	struct sk_buff *skb;
+	int err;
+
+	fp = kmalloc(sizeof(*fp) + size, GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, test->insns, size);
+	atomic_set(&fp->refcnt, 1);
+	fp->len = test->len;
+	fp->bpf_func = NULL;
+
+	err = sk_chk_filter(fp->insns, fp->len);
+	if (err) {
+		printk(KERN_ERR "bpf_jit_test: %s: invalid filter\n",
+		       test->name);
+		goto out;
+	}
+
+	bpf_jit_compile(fp);
+	if (!fp->bpf_func) {
+		printk(KERN_ERR "bpf_jit_test: %s: not compiled\n",
+		       test->name);
+		err = -EINVAL;
+		goto out;
+	}
+
+	skb = test_skb(test->flags);
+	if (!skb) {
+		err = -ENOMEM;
+		goto out_jit;
+	}
+	interp = sk_run_filter(skb, fp->insns, fp->len);
+	jit = SK_RUN_FILTER(fp, skb);
+	kfree_skb(skb);
+
+	if (interp != jit) {
+		printk(KERN_ERR "bpf_jit_test: %s: interpreter returned %u, "
+		       "JIT returned %u\n", test->name, interp, jit);
+		err = -EINVAL;
+	}
+
+out_jit:
+	bpf_jit_free(fp);
+out:
+	kfree(fp);
+	return err;
+}
+
+static int __init bpf_jit_test_init(void)
+{
+	int saved = bpf_jit_enable;
+	int i, failed = 0;
+
+	bpf_jit_enable = 1;
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		if (run_test(&tests[i]))
+			failed++;
+	bpf_jit_enable = saved;
+
+	printk(KERN_INFO "bpf_jit_test: %d of %d tests passed\n",
+	       (int)ARRAY_SIZE(tests) - failed, (int)ARRAY_SIZE(tests));
+
+	return failed ? -EINVAL : -EAGAIN;
+}
+
+static void __exit bpf_jit_test_exit(void) { }
+
+module_init(bpf_jit_test_init);
+module_exit(bpf_jit_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BPF JIT self test");
@@ -64,6 +64,25 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/**
+ *	bpf_load_pointer - load packet data the way sk_run_filter() does
+ *	@skb: buffer to load from
+ *	@k: offset, possibly relative to SKF_NET_OFF or SKF_LL_OFF
+ *	@size: number of bytes wanted
+ *	@buffer: bounce buffer used when the data is not linear
+ *
+ * Slow path for the BPF JITs, so that loads which miss the linear
+ * header area behave exactly as in the interpreter.  Returns NULL
+ * where sk_run_filter() would drop the packet; ancillary offsets
+ * are not handled here.
+ */
+void *bpf_load_pointer(struct sk_buff *skb, int k, unsigned int size,
+		       void *buffer)
+{
+	return load_pointer(skb, k, size, buffer);
+}
+EXPORT_SYMBOL(bpf_load_pointer);
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +107,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -507,6 +525,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -514,6 +533,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -520,6 +520,20 @@ int security_inode_permission(struct inode *inode, int mask)
 	return security_ops->inode_permission(inode, mask);
 }
 
+/*
+ * Variant for the reference-free path walk, which runs under a spinlock.
+ * Only the default hook is known not to sleep or take dcache_lock; any
+ * other module makes the walk fall back to the ordinary one.
+ */
+int security_inode_permission_rcu(struct inode *inode, int mask)
+{
+	if (unlikely(IS_PRIVATE(inode)))
+		return 0;
+	if (security_ops != &default_security_ops)
+		return -ECHILD;
+	return security_ops->inode_permission(inode, mask);
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	if (unlikely(IS_PRIVATE(dentry->d_inode)))